@@ -24,7 +24,7 @@
 #define	FALSE	0
 
 /* GDT 和 IDT 中描述符的个数 */
-#define	GDT_SIZE	128
+#define	GDT_SIZE	512	//each PCB owns a LDT descriptor, see NR_PCBS
 #define	IDT_SIZE	256
 
 /* 权限 */
@@ -50,6 +50,59 @@
 			     */
 #define TIMER_FREQ     1193182L/* clock frequency for timer in PC and AT */
 #define HZ             100  /* clock freq (software settable on IBM-PC) */
+#define TIMER_COUNT    (TIMER_FREQ/HZ)	/* counts of one tick */
+#define TIMER_ONESHOT  0x30 /* 00-11-000-0 :
+			     * Counter0 - LSB then MSB - interrupt on terminal count - binary
+			     */
+#define TIMER_LATCH    0x00 /* 00-00-000-0 : latch the count of counter0 */
+#define TIMER_READBACK 0xC2 /* 11-0-0-001-0 : latch both status and count of counter0 */
+#define TIMER_OUT      0x80 /* OUT pin in the status byte, set when one-shot has fired */
+#define TIMER2         0x42 /* I/O port for timer channel 2, used to calibrate the TSC */
+#define TIMER2_ONESHOT 0xB0 /* 10-11-000-0 :
+			     * Counter2 - LSB then MSB - interrupt on terminal count - binary
+			     */
+#define TIMER2_GATE    0x61 /* bit 0 gates counter2, bit 1 enables the speaker */
+#define TIMER2_OUT     0x20 /* OUT pin of counter2, read from TIMER2_GATE */
+
+/* monotonic clock, see clock.c. the TSC is measured against counter2
+ * for CALIBRATE_MS milliseconds at boot.
+ */
+#define CALIBRATE_MS   50
+#define NSEC_PER_SEC   1000000000
+#define NSEC_PER_MSEC  1000000
+#define CLOCK_MONOTONIC 1	/* keep the same with stdio.h */
+
+/* tickless idle: when only the idle task can run, the periodic tick is replaced
+ * by a one-shot timer which fires at the earliest sleeper deadline. the 16-bit
+ * counter limits a one-shot to MAX_IDLE_TICKS ticks.
+ */
+#define TICKLESS_IDLE  1	/* 0 to keep the periodic tick in idle */
+#define MAX_IDLE_TICKS (0xFFFF / TIMER_COUNT)
+
+/* scheduling policy, chosen at build time.
+ * 0: O(1) priority runqueue, a process runs for priority ticks in turn (proc.c)
+ * 1: fair scheduler ordered by weighted virtual runtime (sched_fair.c)
+ */
+#define SCHED_FAIR     0
+#define SCHED_LATENCY_TICKS  6			/* every READY process runs once in this period */
+#define SCHED_WAKEUP_GRAN    1000000	/* TSC cycles a woken process must lead by to preempt */
+#define SCHED_SLEEPER_CREDIT 3000000	/* TSC cycles of vruntime a sleeper may lag behind */
+
+/* address space affinity, see mm_preferred_cr3() in proc.c. a process sharing
+ * the page directory of the last one is taken first, at most SCHED_MM_BATCH
+ * times in a row (default of set_mm_batch(), 0 to turn it off, no more than
+ * SCHED_MM_BATCH_MAX), and only among the first SCHED_MM_SCAN processes of
+ * the same priority level.
+ */
+#define SCHED_MM_BATCH       4
+#define SCHED_MM_BATCH_MAX   32
+#define SCHED_MM_SCAN        8
+
+/* ring-3 processes enter the kernel by sysenter instead of int 0x90 when the
+ * cpu supports it, see sysenter_entry in kernel.asm. must be the same as in
+ * sconst.inc!!!
+ */
+#define FAST_SYSCALL   1
 
 /* Hardware interrupts */
 #define	NR_IRQ		16	/* Number of IRQs */
@@ -65,7 +118,7 @@
 #define	AT_WINI_IRQ	14	/* at winchester */
 
 /* system call */
-#define NR_SYS_CALL     23	//last modified by xw, 18/6/19
+#define NR_SYS_CALL     37	//last modified by xw, 18/6/19
 
 /*页表相关*/
 #define	PageTblNumAddr		0x500	//页表数量放在这个位置,必须与load.inc中一致					add by visual 2016.5.11
@@ -113,7 +166,13 @@
 #define	PG_RWW		2	// R/W 属性位值, 读/写/执行
 #define	PG_USS		0	// U/S 属性位值, 系统级
 #define	PG_USU		4	// U/S 属性位值, 用户级
+#define	PG_G		256	// G属性位值, 全局页, 开启 CR4.PGE 后切换 cr3 时不会从 TLB 中刷掉
 #define PG_PS		64	// PS属性位值，4K页
+#define PG_COW		512	// 可用位, 只读的fork共享页, 写时复制, see cow_fault()
+
+/* page fault error code */
+#define PF_PROT		1	// 页存在, 违反了保护
+#define PF_WRITE	2	// 写访问
 
 
 
@@ -26,9 +26,16 @@ EXTERN  int     u_proc_sum; 		//内核中用户进程/线程数量 add by visual
 EXTERN	TSS		tss;
 EXTERN	PROCESS*	p_proc_current;
 EXTERN	PROCESS*	p_proc_next;	//the next process that will run. added by xw, 18/4/26
+EXTERN	RUNQUEUE	rq;				//READY processes waiting for the cpu
+EXTERN	PROCESS*	pcb_free_list;	//IDLE PCBs that can be allocated, linked by rq_next
+EXTERN	IDLE_STAT	idle_stat;
+EXTERN	SWITCH_STAT	switch_stat;
+EXTERN	LOAD_STAT	load_stat;
+EXTERN	SCHED_HIST	sched_hist;		//of all processes, see schedule()
+EXTERN	KMEM_CACHE	pgtable_cache;	//page directories and page tables, see slab.c
 
 extern	PROCESS		cpu_table[];	//added by xw, 18/6/1
-extern	PROCESS		proc_table[];
+EXTERN	CPU			cpus[NR_CPUS];
 extern	char		task_stack[];
 extern  TASK        task_table[];
 extern	irq_handler	irq_table[];
@@ -269,6 +269,7 @@ typedef struct rdwt_info
 	void *kbuf;
 	PROCESS *proc;
 	struct rdwt_info *next;
+	WAIT_QUEUE wait;	//the requesting process sleeps here until the request is done
 } RWInfo;
 
 typedef struct
@@ -281,6 +282,7 @@ PUBLIC void init_hd();
 PUBLIC void hd_open(int device);
 PUBLIC void hd_close(int device);
 PUBLIC void hd_service();
+PUBLIC void sys_hd_wait();
 
 PUBLIC void hd_rdwt(MESSAGE *p);
 PUBLIC void hd_rdwt_sched(MESSAGE *p);
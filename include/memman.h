@@ -6,7 +6,6 @@
 #include "global.h"
 #include "proto.h"
 
-#define MEMMAN_FREES	4090		//32KB
 #define MEMMAN_ADDR	0x01ff0000	//存memman，31M960K
 #define FMIBuff		0x007ff000	//loader中getFreeMemInfo返回值存放起始地址(7M1020K)
 #define KWALL		0x00600000
@@ -15,12 +14,36 @@
 #define MEMSTART	0x00400000
 #define MEMEND		0x02000000
 #define TEST		0x11223344
-struct FREEINFO{
-	u32 addr,size;
-};					
+
+/* physical memory from MEMSTART to MEMEND is split into zones at the walls,
+ * each one a separate binary buddy pool of 2^order frames blocks.
+ */
+#define ZONE_KPAGE	0			//4～6M, kmalloc_4k
+#define ZONE_KERNEL	1			//6～8M, kmalloc
+#define ZONE_USER	2			//8～16M, malloc
+#define ZONE_UPAGE	3			//16～32M, malloc_4k
+#define NR_ZONES	4
+#define BUDDY_MAX_ORDER	12		//2^12 frames, the 16M of ZONE_UPAGE
+#define NR_FRAMES	((MEMEND - MEMSTART) >> 12)
+#define FRAME_NONE	0xFFFF		//end of a free list
+#define FRAME_FREE	0x80		//in FRAME.order, the frame heads a free block
+
+struct FRAME{					//one for each 4KB frame from MEMSTART
+	u16 next,prev;				//free list of its order, if it heads a free block
+	u8 order;					//order of the block it heads, with FRAME_FREE
+	u8 refs;					//extra mappings of a user frame shared by fork, < NR_PCBS
+};
+
+struct ZONE{
+	u32 base,limit;				//frames in [base, limit)
+	u32 free_frames;
+	u16 free[BUDDY_MAX_ORDER + 1];	//first free block of each order
+};
 
 struct MEMMAN{
-	u32 frees,maxfrees,lostsize,losts;	//frees为当前空闲内存块数
-	struct FREEINFO free[MEMMAN_FREES];	//空闲内存
+	SPINLOCK lock;				//the zones, the frames and the counts below
+	u32 lostsize,losts;			//frees failed
+	struct ZONE zone[NR_ZONES];
+	struct FRAME frame[NR_FRAMES];
 };
 
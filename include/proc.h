@@ -42,9 +42,20 @@
 //the memory space we put kernel is 0x30400~0x6ffff, so we should limit kernel size
 // #define NR_PCBS	32		//add by visual 2016.4.5
 // #define NR_K_PCBS 10		//add by visual 2016.4.5
-#define NR_PCBS		12
+/* PCBs are no longer kept in a static proc_table, they are allocated from
+ * kernel memory PCBS_PER_SLAB at a time when the free list is empty, and
+ * each of them gets a LDT descriptor in GDT then. NR_PCBS is only the upper
+ * limit, which is bounded by GDT_SIZE and the kmalloc memory (6M~8M).
+ */
+#define NR_PCBS		192
+#define PCBS_PER_SLAB	4
 #define NR_TASKS	4	//TestA~TestC + hd_service
-#define NR_K_PCBS	4	//no K_PCB is empty now
+#define INIT_PID	NR_TASKS	//initial is allocated right after the tasks, orphans are given to it
+
+/* pids are handed out round-robin from 0~NR_PIDS-1, and pid_table maps a
+ * pid to its PCB, so a pid is not an index into any PCB array.
+ */
+#define NR_PIDS		1024
 
 //~xw
 
@@ -53,13 +64,14 @@
 
 //enum proc_stat	{IDLE,READY,WAITING,RUNNING};		//add by visual smile 2016.4.5
 //enum proc_stat	{IDLE,READY,SLEEPING};		//eliminate RUNNING state
-enum proc_stat	{IDLE,READY,SLEEPING,KILLED};	/* add KILLED state. when a process's state is KILLED, the process
+enum proc_stat	{IDLE,READY,SLEEPING,KILLED,ZOMBIE};	/* add KILLED state. when a process's state is KILLED, the process
 												 * won't be scheduled anymore, but all of the resources owned by
 												 * it is not freed yet.
 												 * added by xw, 18/12/19
+												 * ZOMBIE is the same, but the process has called exit(). both
+												 * are reaped by wait() or pthread_join(), see exit.c
 												 */
 
-#define NR_CHILD_MAX (NR_PCBS-NR_K_PCBS-1)    //定义最多子进程/线程数量	//add by visual 2016.5.26
 #define TYPE_PROCESS	0//进程//add by visual 2016.5.26
 #define TYPE_THREAD		1//线程//add by visual 2016.5.26
 
@@ -89,9 +101,9 @@ typedef struct s_tree_info{//进程树记录，包括父进程，子进程，子
 	int real_ppid;  	//亲父进程，创建它的那个进程
 	int ppid;			//当前父进程	
 	int child_p_num;	//子进程数量
-	int child_process[NR_CHILD_MAX];//子进程列表
 	int child_t_num;		//子线程数量
-	int child_thread[NR_CHILD_MAX];//子线程列表	
+	union task_union *child_list;	//子进程和子线程链表, linked by sibling, so there is no NR_CHILD_MAX
+	union task_union *sibling;		//next child of the same parent
 	int text_hold;			//是否拥有代码
 	int data_hold;			//是否拥有数据
 }TREE_INFO;
@@ -114,6 +126,127 @@ typedef struct s_lin_memmap {//线性地址分布结构体	edit by visual 2016.5
 	u32 stack_child_limit;					//分给子线程的栈的界限		//add by visual 2016.5.27
 }LIN_MEMMAP;
 
+/* O(1) runqueue. Each priority level owns a circular list of READY processes,
+ * and bit i of bitmap is set when level i isn't empty, so picking the next
+ * process doesn't depend on the number of PCBs. A bigger level means a higher
+ * priority, just as a bigger ticks value won in the old linear scan.
+ */
+#define NR_PRIOS	32		//number of priority levels, must not exceed the bits of u32
+
+/* scheduling classes. real-time processes always run before normal ones,
+ * see pick_next_proc(). keep the same with stdio.h.
+ */
+#define SCHED_NORMAL	0	//scheduled by the O(1) or the fair policy
+#define SCHED_FIFO		1	//real-time, runs until it sleeps or yields to a higher one
+#define SCHED_RR		2	//real-time, round robin among the same rt_priority
+#define RR_TIMESLICE	5	//ticks a SCHED_RR process runs in turn
+
+/* futex operations, keep the same with stdio.h */
+#define FUTEX_WAIT		0
+#define FUTEX_WAKE		1
+
+typedef struct s_prio_array {
+	int nr_active;							//number of processes queued in this array
+	u32 bitmap;								//bit i is set if queue[i] isn't empty
+	union task_union *queue[NR_PRIOS];		//head of the circular list of each level
+}PRIO_ARRAY;
+
+/* wait queue. processes waiting for the same event are linked in FIFO order
+ * through wq_next/wq_prev in their PCBs, so a wakeup only touches the
+ * processes which really wait on the queue.
+ */
+typedef struct s_wait_queue {
+	union task_union *head;		//the first waiting process, woken first by wake_up_one()
+	union task_union *tail;
+}WAIT_QUEUE;
+
+#define NR_CHAN_HASH	64		//number of wait queues shared by sleep channels, power of 2
+
+/* locks, see lock.c. a lock initialized with a name is listed for
+ * get_lock_stat(), at most NR_LOCK_STATS of them.
+ */
+#define NR_LOCK_STATS	32
+#define LOCK_NAME_LEN	16
+
+typedef struct s_lock_stat {	//keep the same with struct lock_stat in stdio.h
+	char	name[LOCK_NAME_LEN];
+	u32		acquired;			//times the lock is taken
+	u32		contended;			//times a taker had to spin or sleep
+	u64		wait_cycles;		//TSC cycles spent waiting in total
+	u64		hold_cycles;		//TSC cycles the lock is held in total
+	u64		hold_max;			//the longest hold in TSC cycles
+}LOCK_STAT;
+
+typedef struct s_spinlock {
+	volatile u32 locked;
+	u32		eflags;				//saved by spin_lock(), restored by spin_unlock()
+	u64		acquire_tsc;
+	LOCK_STAT stat;
+}SPINLOCK;
+
+typedef struct s_mutex {
+	int		locked;
+	union task_union *owner;
+	WAIT_QUEUE wait;			//processes sleeping for the mutex
+	u64		acquire_tsc;
+	LOCK_STAT stat;
+}MUTEX;
+
+typedef struct s_semaphore {
+	int		count;
+	WAIT_QUEUE wait;			//processes sleeping in down()
+	LOCK_STAT stat;				//hold time isn't counted
+}SEMAPHORE;
+
+/* object caches, see slab.c. a cache is listed for get_slab_stat(), at
+ * most NR_SLAB_STATS of them.
+ */
+#define NR_SLAB_STATS	16
+#define SLAB_PAGE		1		//slabs are single frames from kmalloc_4k, for page tables
+
+typedef struct s_slab_stat {	//keep the same with struct slab_stat in stdio.h
+	char	name[16];
+	u32		obj_size;
+	u32		slabs;				//slabs got from memman
+	u32		total;				//objects in the slabs
+	u32		active;				//objects in use
+	u32		allocs;
+	u32		frees;
+}SLAB_STAT;
+
+typedef struct s_kmem_cache {
+	u32		size;				//object size with its free pointer, aligned
+	u32		offset;				//where the free pointer is in a free object
+	u32		slab_size;
+	int		flags;
+	void	(*ctor)(void *obj);	//called once for each object when its slab is made
+	void	*free_list;
+	SLAB_STAT stat;
+}KMEM_CACHE;
+
+/* kernel timer, see timer.c */
+typedef struct s_timer {
+	struct s_timer *next;		//next timer in the same slot of the timer wheel
+	struct s_timer **pprev;		//the pointer which points to this timer, 0 if not pending
+	u32 expires;				//the tick at which function is called
+	void (*function)(u32 data);
+	u32 data;
+}TIMER;
+
+/* log2 histograms of scheduling delays in TSC cycles. bucket i counts the
+ * values in [2^i, 2^(i+1)), bucket 0 also counts 0, and values of 2^32 or
+ * more go to the last bucket.
+ */
+#define NR_HIST_BUCKETS	32
+
+typedef struct s_sched_hist {	//keep the same with struct sched_hist in stdio.h
+	u32 wakeup[NR_HIST_BUCKETS];	//from wakeup_proc() to running
+	u32 rq_delay[NR_HIST_BUCKETS];	//from getting READY or being preempted to running
+	u32 slice[NR_HIST_BUCKETS];		//from running to being switched out
+}SCHED_HIST;
+
+#define FPU_AREA_SIZE	512		//of fxsave, fnsave only needs 108 bytes
+
 typedef struct s_proc {
 	STACK_FRAME regs;          /* process registers saved in stack frame */
 
@@ -146,6 +279,46 @@ typedef struct s_proc {
 	//added by zcr
 	struct file_desc * filp[NR_FILES];
 	//~zcr
+	
+	/* runqueue links. new fields must be appended here, for sconst.inc
+	 * depends on the offsets of the fields above.
+	 */
+	union task_union *rq_next;	//next process in the same level, or next free PCB
+	union task_union *rq_prev;	//previous process in the same level
+	PRIO_ARRAY *rq_array;		//the array the process is queued in, 0 if not queued
+	int rq_prio;				//the level the process is queued in
+	
+	u64 wakeup_tsc;				//TSC when a sleeping process is woken, 0 if not woken
+	TIMER sleep_timer;			//wakes up the process in sys_sleep
+	
+	union task_union *wq_next;	//next process in the same wait queue
+	union task_union *wq_prev;	//previous process in the same wait queue
+	WAIT_QUEUE *wq;				//the wait queue the process sleeps on, 0 if none
+	
+	u64 vruntime;				//weighted running time in TSC cycles, used by SCHED_FAIR
+	u64 exec_start;				//TSC when the process got the cpu
+	u32 weight;					//load weight the process is queued with
+	int heap_idx;				//position in the vruntime heap, 0 if not queued
+	
+	int policy;					//SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+	int rt_priority;			//0~NR_PRIOS-1 for real-time processes, bigger is higher
+	
+	u64 ready_tsc;				//TSC when the process is queued or preempted, 0 if running or sleeping
+	u64 run_tsc;				//TSC when the process got the cpu last time
+	SCHED_HIST hist;
+	
+	int fpu_used;				//1 if fpu_area holds a saved state, see fpu.c
+	u8 fpu_area[FPU_AREA_SIZE + 16];	//x87/SSE state, aligned to 16 bytes in it
+	
+	int exit_status;			//passed to exit(), read by the reaper
+	int killed;					//a thread whose process has exited or exec'ed, see exit_killed()
+	
+	u64 utime;					//TSC cycles run outside ring 0
+	u64 stime;					//TSC cycles run in the kernel, interrupts taken included
+	u64 acct_tsc;				//TSC when utime or stime was charged last time
+	u32 nvcsw;					//switches by sleeping or exiting
+	u32 nivcsw;					//switches by being preempted or yielding
+	u32 nsyscalls;
 }PROCESS_0;
 
 //new PROCESS struct with PCB and process's kernel stack
@@ -155,10 +328,94 @@ typedef union task_union {
 	char stack[INIT_STACK_SIZE/sizeof(char)];
 }PROCESS;
 
+#if SCHED_FAIR
+/* READY processes are kept in a binary min-heap ordered by vruntime, heap[1]
+ * is the one which has got the least cpu time in proportion to its weight.
+ */
+typedef struct s_runqueue {
+	int nr_running;				//number of processes in the heap
+	u32 load_weight;			//sum of the weights of queued processes
+	u64 min_vruntime;			//monotonic lower bound of queued vruntimes
+	union task_union *heap[NR_PCBS + 1];	//heap[0] is unused
+}RUNQUEUE;
+#else
+typedef struct s_runqueue {
+	int nr_running;				//number of queued processes in both arrays
+	PRIO_ARRAY *active;			//processes which still have ticks left
+	PRIO_ARRAY *expired;		//processes which have used up their ticks
+	PRIO_ARRAY arrays[2];
+}RUNQUEUE;
+#endif
+
+/* statistics of the idle task and tickless idle */
+typedef struct s_idle_stat {
+	u32 idle_count;			//times the idle task is switched in
+	u32 oneshot_count;		//times the periodic tick is stopped in idle
+	u32 ticks_skipped;		//clock interrupts saved by one-shot timer
+	u32 wakeups;			//woken processes that have got the cpu
+	u64 wakeup_cycles;		//total wakeup latency in TSC cycles, from wakeup_proc() to running
+	u64 wakeup_max;			//the worst wakeup latency in TSC cycles
+	u64 idle_cycles;		//TSC cycles the idle task has run
+}IDLE_STAT;
+
+/* load averages are kept like Linux's, in fixed point with FSHIFT bits,
+ * and updated every LOAD_FREQ ticks with the number of READY processes.
+ * EXP_n is FIXED_1/exp(5s/n min).
+ */
+#define FSHIFT		11
+#define FIXED_1		(1 << FSHIFT)
+#define LOAD_FREQ	(5 * HZ)
+#define EXP_1		1884
+#define EXP_5		2014
+#define EXP_15		2037
+
+/* system-wide cpu load, see clock.c */
+typedef struct s_load_stat {	//keep the same with struct load_stat in stdio.h
+	u64 tsc;				//TSC when it's copied by get_task_stat()
+	u32 avenrun[3];			//1, 5 and 15 minutes load averages
+	u32 idle_pct;			//idle percentage of cpus[0] in the last second
+	u32 nr_ready;			//READY processes at the last update
+}LOAD_STAT;
+
+/* cpu accounting of a process, copied by get_task_stat() */
+typedef struct s_task_stat {	//keep the same with struct task_stat in stdio.h
+	int pid;
+	int ppid;
+	char name[16];
+	int stat;				//enum proc_stat
+	int type;				//TYPE_PROCESS or TYPE_THREAD
+	u64 utime;
+	u64 stime;
+	u32 nvcsw;
+	u32 nivcsw;
+	u32 nsyscalls;
+}TASK_STAT;
+
+/* a time read by clock_gettime() */
+typedef struct s_timespec {	//keep the same with struct timespec in stdio.h
+	u32 tv_sec;
+	u32 tv_nsec;
+}TIMESPEC;
+
+/* statistics of process switches, see switch_pde() */
+typedef struct s_switch_stat {
+	u32 switches;			//times renew_env runs for another process
+	u32 cr3_skipped;		//switches within one address space, without reloading cr3
+	u32 mm_preferred;		//times a process is taken before the policy's choice for sharing cr3
+	u32 mm_per_sec;			//switches reloading cr3 in the last second, see clock_handler()
+}SWITCH_STAT;
+
+/* per-cpu state, the idle task of a cpu is in cpu_table */
+typedef struct s_cpu {
+	int		need_resched;	//schedule() must run before returning to the process, see resched_curr()
+}CPU;
+
 typedef struct s_task {
 	task_f	initial_eip;
 	int	stacksize;
 	char	name[32];
+	int	policy;			//scheduling class, SCHED_NORMAL if omitted
+	int	rt_priority;
 }TASK;
 
 /* stacks of tasks */
@@ -170,4 +427,4 @@ typedef struct s_task {
 //#define STACK_SIZE_TOTAL	(STACK_SIZE_TASK*NR_PCBS)	//edit by visual 2016.4.5
 
 //added by zcr
-#define proc2pid(x) (x - proc_table)
+#define proc2pid(x) ((x)->task.pid)		//pid isn't an index into a PCB array any more
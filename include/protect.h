@@ -70,14 +70,40 @@ typedef struct s_tss {
 #define	INDEX_FLAT_RW		2	// ┃
 #define	INDEX_VIDEO		3	// ┛
 #define	INDEX_TSS		4
-#define	INDEX_LDT_FIRST		5
+#define	INDEX_SYSENTER_CS	5	// ┓
+#define	INDEX_SYSENTER_SS	6	// ┣ sysenter/sysexit 要求这四个描述符依次排列
+#define	INDEX_USER_CS		7	// ┃
+#define	INDEX_USER_DS		8	// ┛
+#define	INDEX_LDT_FIRST		9
 /* 选择子 */
 #define	SELECTOR_DUMMY		   0		// ┓
 #define	SELECTOR_FLAT_C		0x08		// ┣ LOADER 里面已经确定了的.
 #define	SELECTOR_FLAT_RW	0x10		// ┃
 #define	SELECTOR_VIDEO		(0x18+3)	// ┛<-- RPL=3
 #define	SELECTOR_TSS		0x20		// TSS. 从外层跳到内存时 SS 和 ESP 的值从里面获得.
-#define SELECTOR_LDT_FIRST	0x28
+#define	SELECTOR_SYSENTER_CS	0x28		// 写入 IA32_SYSENTER_CS
+#define	SELECTOR_USER_CS	(0x38+3)	// sysexit 返回后的 CS 和 SS
+#define	SELECTOR_USER_DS	(0x40+3)
+#define SELECTOR_LDT_FIRST	0x48
+
+/* sysenter */
+#define	CPUID_SEP		(1 << 11)	/* CPUID.01H:EDX, sysenter/sysexit */
+#define	CPUID_PGE		(1 << 13)	/* CPUID.01H:EDX, global pages */
+#define	CR4_PGE			0x80
+
+/* FPU/SSE, see fpu.c */
+#define	CPUID_FXSR		(1 << 24)	/* CPUID.01H:EDX, fxsave/fxrstor */
+#define	CPUID_SSE		(1 << 25)
+#define	CR0_MP			0x02
+#define	CR0_EM			0x04
+#define	CR0_TS			0x08
+#define	CR0_NE			0x20
+#define	CR0_WP			0x10000
+#define	CR4_OSFXSR		0x200
+#define	CR4_OSXMMEXCPT		0x400
+#define	MSR_SYSENTER_CS		0x174
+#define	MSR_SYSENTER_ESP	0x175
+#define	MSR_SYSENTER_EIP	0x176
 
 #define	SELECTOR_KERNEL_CS	SELECTOR_FLAT_C
 #define	SELECTOR_KERNEL_DS	SELECTOR_FLAT_RW
@@ -143,6 +169,7 @@ typedef struct s_tss {
 #define	INT_VECTOR_PROTECTION		0xD
 #define	INT_VECTOR_PAGE_FAULT		0xE
 #define	INT_VECTOR_COPROC_ERR		0x10
+#define	INT_VECTOR_SIMD_ERR		0x13	//#XM, SSE exceptions are unmasked by CR4_OSXMMEXCPT
 
 /* 中断向量 */
 #define	INT_VECTOR_IRQ0			0x20
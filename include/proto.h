@@ -15,6 +15,8 @@ PUBLIC void	disable_irq(int irq);
 PUBLIC void	enable_irq(int irq);
 PUBLIC void	disable_int();
 PUBLIC void	enable_int();
+PUBLIC u32	disable_int_save();
+PUBLIC void	restore_int(u32 eflags);
 PUBLIC void	port_read(u16 port, void* buf, int n);
 PUBLIC void	port_write(u16 port, void* buf, int n);
 //~zcr
@@ -22,13 +24,37 @@ PUBLIC void	port_write(u16 port, void* buf, int n);
 /* protect.c */
 PUBLIC void	init_prot();
 PUBLIC u32	seg2phys(u16 seg);
+PUBLIC u16	alloc_ldt_desc(DESCRIPTOR *ldts);
+PUBLIC void	init_sysenter(TSS *t);
+PUBLIC u32	cpuid_edx(u32 leaf);
+
+/* memman.c */
+PUBLIC u32	test_kmalloc(u32 size);
+PUBLIC u32	test_kmalloc_4k();
+PUBLIC u32	test_malloc_4k();
+PUBLIC u32	test_free_4k(u32 addr);
+PUBLIC u32	test_free(u32 addr, u32 size);
+PUBLIC void	frame_get(u32 addr);
+PUBLIC u32	frame_refs(u32 addr);
+
+/* slab.c */
+PUBLIC void	kmem_cache_init(KMEM_CACHE *cache, char *name, u32 size, u32 align,
+							void (*ctor)(void*), int flags);
+PUBLIC void* kmem_cache_alloc(KMEM_CACHE *cache);
+PUBLIC void	kmem_cache_free(KMEM_CACHE *cache, void *obj);
+PUBLIC void* kmem_alloc(u32 size);
+PUBLIC void	kmem_free(void *obj, u32 size);
+PUBLIC void	kmem_init();
+PUBLIC int	sys_get_slab_stat(void *uesp);
 
 /* klib.c */
+PUBLIC void	disp_int(int input);
 PUBLIC void	delay(int time);
 
 /* kernel.asm */
 u32  read_cr2();			//add by visual 2016.5.9
 void refresh_page_cache();  //add by visual 2016.5.12
+void invlpg(u32 AddrLin);
 //void restart_int();
 //void save_context();
 void restart_initial();		//added by xw, 18/4/18
@@ -36,6 +62,7 @@ void restart_restore();		//added by xw, 18/4/20
 void sched();				//added by xw, 18/4/18
 void halt();                //added by xw, 18/6/11
 u32 get_arg(void *uesp, int order);	//added by xw, 18/6/18
+u64 read_tsc();
 
 /* ktest.c */
 void TestA();
@@ -49,6 +76,40 @@ PUBLIC void spurious_irq(int irq);
 
 /* clock.c */
 PUBLIC void clock_handler(int irq);
+PUBLIC void tick_nohz_enter();
+PUBLIC void tick_nohz_exit();
+PUBLIC void calibrate_tsc();
+PUBLIC u64  div_u64_rem(u64 n, u32 d, u32 *rem);
+PUBLIC u64  ktime_get_ns();
+PUBLIC int  sys_clock_gettime(void *uesp);
+PUBLIC void milli_delay(int milli_sec);
+
+/* timer.c */
+PUBLIC void init_timers();
+PUBLIC void add_timer(TIMER *timer);
+PUBLIC int  del_timer(TIMER *timer);
+PUBLIC void run_timers();
+PUBLIC int  timer_next_expiry(int max);
+
+/* fpu.c */
+PUBLIC void	init_fpu();
+PUBLIC void	fpu_nm_handler();
+PUBLIC void	fpu_switch(PROCESS *prev, PROCESS *next);
+PUBLIC void	fpu_sync(PROCESS *p);
+PUBLIC void	fpu_release(PROCESS *p);
+
+/* lock.c */
+PUBLIC void spin_lock_init(SPINLOCK *lock, char *name);
+PUBLIC void spin_lock(SPINLOCK *lock);
+PUBLIC void spin_unlock(SPINLOCK *lock);
+PUBLIC void mutex_init(MUTEX *mutex, char *name);
+PUBLIC void mutex_lock(MUTEX *mutex);
+PUBLIC int  mutex_trylock(MUTEX *mutex);
+PUBLIC void mutex_unlock(MUTEX *mutex);
+PUBLIC void sema_init(SEMAPHORE *sema, int count, char *name);
+PUBLIC void down(SEMAPHORE *sema);
+PUBLIC void up(SEMAPHORE *sema);
+PUBLIC int  sys_get_lock_stat(void *uesp);
 
 /***************************************************************
 * 以下是系统调用相关函数的声明	
@@ -72,6 +133,11 @@ PUBLIC void yield();				//added by xw, 18/4/19
 PUBLIC void sleep(int n);			//added by xw, 18/4/19
 PUBLIC void print_E();
 PUBLIC void print_F();
+PUBLIC void hd_wait();
+PUBLIC int sched_setscheduler(int pid, int policy, int rt_priority);
+PUBLIC int get_switch_stat(SWITCH_STAT *buf);
+PUBLIC int set_mm_batch(int n);
+PUBLIC int futex(int *uaddr, int op, int val);
 
 /* syscallc.c */		//edit by visual 2016.4.6
 PUBLIC int   sys_get_ticks();           /* sys_call */
@@ -87,13 +153,51 @@ PUBLIC void sys_udisp_int(int arg);		//add by visual 2016.5.16
 PUBLIC void sys_udisp_str(char* arg);		//add by visual 2016.5.16
 
 /* proc.c */
+PUBLIC void init_runqueue();
+PUBLIC void enqueue_proc(PROCESS *p);
+PUBLIC void dequeue_proc(PROCESS *p);
+PUBLIC PROCESS* pick_next_proc(PROCESS *prev);
+PUBLIC int set_scheduler(PROCESS *p, int policy, int rt_priority);
+PUBLIC int sys_sched_setscheduler(void *uesp);
+PUBLIC int sys_get_sched_hist(void *uesp);
+PUBLIC void resched_curr();
+PUBLIC u32 mm_preferred_cr3();
+PUBLIC void mm_account_pick(PROCESS *first, PROCESS *next);
+PUBLIC int sys_set_mm_batch(int n);
+PUBLIC int sys_futex(void *uesp);
+PUBLIC void acct_kernel_enter();
+PUBLIC void acct_kernel_exit();
+PUBLIC void acct_syscall();
+PUBLIC int nr_ready_procs();
+PUBLIC int sys_get_task_stat(void *uesp);
+
+/* proc.c, or sched_fair.c if SCHED_FAIR */
+PUBLIC void normal_init_rq();
+PUBLIC void normal_enqueue(PROCESS *p);
+PUBLIC void normal_dequeue(PROCESS *p);
+PUBLIC void normal_put_prev(PROCESS *prev);
+PUBLIC PROCESS* normal_pick_next(PROCESS *prev);
+PUBLIC int normal_wakeup_preempt(PROCESS *p, PROCESS *curr);
+PUBLIC void wakeup_proc(PROCESS *p);
+PUBLIC void clear_proc_links(PROCESS *p);
+PUBLIC void cpu_idle();
 PUBLIC PROCESS* alloc_PCB();
 PUBLIC void free_PCB(PROCESS *p);
+PUBLIC PROCESS* pid2proc(int pid);
+PUBLIC void add_child(PROCESS *parent, PROCESS *child);
 PUBLIC void sys_yield();
 PUBLIC void sys_sleep(int n);
+PUBLIC void init_wait_queue(WAIT_QUEUE *wq);
+PUBLIC void sleep_on(WAIT_QUEUE *wq);
+PUBLIC int  wake_up(WAIT_QUEUE *wq);
+PUBLIC int  wake_up_one(WAIT_QUEUE *wq);
+PUBLIC void sleep_on_channel(void *channel);
 PUBLIC void sys_wakeup(void *channel);
+PUBLIC void sys_wakeup_one(void *channel);
+PUBLIC void stop_proc(PROCESS *p);
 PUBLIC int ldt_seg_linear(PROCESS *p, int idx);
 PUBLIC void* va2la(int pid, void* va);
+PUBLIC int user_buf_ok(void *buf, u32 size);
 
 /* testfunc.c */
 PUBLIC void sys_print_E();
@@ -103,12 +207,24 @@ PUBLIC void sys_print_F();
 PUBLIC u32 sys_exec(char* path);		//add by visual 2016.5.23
 /*fork.c*/
 PUBLIC int sys_fork();					//add by visual 2016.5.25
+/* exit.c */
+PUBLIC void exit_proc(PROCESS *p, int status);
+PUBLIC void exit_killed();
+PUBLIC void exit_threads();
+PUBLIC int release_user_mem(PROCESS *p);
+PUBLIC void sys_exit(int status);
+PUBLIC int sys_wait(int *status);
+PUBLIC int sys_pthread_join(void *uesp);
 
 /***************************************************************
 * 以上是系统调用相关函数的声明	
 ****************************************************************/
 
 /*pagepte.c*/
+PUBLIC	int switch_pde();
+PUBLIC	void enable_global_pages();
+PUBLIC	void enable_write_protect();
+PUBLIC	int sys_get_switch_stat(SWITCH_STAT *buf);
 PUBLIC	u32 init_page_pte(u32 pid);	//edit by visual 2016.4.28
 PUBLIC 	void page_fault_handler(u32 vec_no, u32 err_code, u32 eip, u32 cs, u32 eflags);//add by visual 2016.4.19
 PUBLIC	u32 get_pde_index(u32 AddrLin);//add by visual 2016.4.28
@@ -121,6 +237,9 @@ PUBLIC 	u32 phy_exist(u32 PageTblPhyAddr,u32 AddrLin);
 PUBLIC 	void write_page_pde(u32 PageDirPhyAddr,u32	AddrLin,u32 TblPhyAddr,u32 Attribute);
 PUBLIC  void write_page_pte(	u32 TblPhyAddr,u32	AddrLin,u32 PhyAddr,u32 Attribute);
 PUBLIC  u32 vmalloc(u32 size);
+PUBLIC	void* sys_sbrk(int increment);
 PUBLIC  int lin_mapping_phy(u32 AddrLin,u32 phy_addr,u32 pid,u32 pde_Attribute,u32 pte_Attribute);//edit by visual 2016.5.19
 PUBLIC	void clear_kernel_pagepte_low();		//add by visual 2016.5.12
+PUBLIC	void unmap_lin_range(u32 pde_phy, u32 base, u32 limit, int free_frame);
+PUBLIC	void free_page_dir(u32 pde_phy);
 
@@ -8,12 +8,15 @@ int get_ticks();
 int get_pid();					
 void* kmalloc(int size);			
 void* kmalloc_4k();			
-void* malloc(int size);			
 void* malloc_4k();				
-int free(void *arg);				
 int free_4k(void* AdddrLin);	
 int fork();			
 int pthread(void *arg);	
+void exit(int status);		//a thread exits alone
+int wait(int *status);		//pid of the reaped child, -1 if no child
+int pthread_join(int tid, int *status);	//0, or -1 if tid isn't a thread of this process
+void* sbrk(int increment);		//the old end of the heap, -1 if it can't move
+void sleep(int n);				//n ticks
 void udisp_int(int arg);
 void udisp_str(char* arg);
 
@@ -35,6 +38,126 @@ int lseek(int fd, int offset, int whence);		//added by xw, 18/6/19
 int unlink(const char *pathname);				//added by xw, 18/6/19
 //~xw
 
+/* scheduling classes, keep the same with proc.h */
+#define SCHED_NORMAL	0
+#define SCHED_FIFO		1
+#define SCHED_RR		2
+
+int sched_setscheduler(int pid, int policy, int rt_priority);	//pid -1 is the caller
+
+/* statistics of a kernel lock, keep the same with LOCK_STAT in proc.h */
+struct lock_stat {
+	char name[16];
+	unsigned int acquired;
+	unsigned int contended;
+	unsigned long long wait_cycles;
+	unsigned long long hold_cycles;
+	unsigned long long hold_max;
+};
+int get_lock_stat(int idx, struct lock_stat *buf);	//-1 if there is no idx-th lock
+
+/* statistics of a kernel object cache, keep the same with SLAB_STAT in proc.h */
+struct slab_stat {
+	char name[16];
+	unsigned int obj_size;
+	unsigned int slabs;
+	unsigned int total;			//objects in the slabs
+	unsigned int active;		//objects in use
+	unsigned int allocs;
+	unsigned int frees;
+};
+int get_slab_stat(int idx, struct slab_stat *buf);	//-1 if there is no idx-th cache
+
+/* log2 histograms of scheduling delays in TSC cycles, keep the same with
+ * SCHED_HIST in proc.h. bucket i counts the values in [2^i, 2^(i+1)).
+ */
+#define NR_HIST_BUCKETS	32
+struct sched_hist {
+	unsigned int wakeup[NR_HIST_BUCKETS];	//from being woken to running
+	unsigned int rq_delay[NR_HIST_BUCKETS];	//from getting READY to running
+	unsigned int slice[NR_HIST_BUCKETS];	//running time each time it gets the cpu
+};
+int get_sched_hist(int pid, struct sched_hist *buf);	//pid -1 for all processes
+
+/* statistics of process switches, keep the same with SWITCH_STAT in proc.h */
+struct switch_stat {
+	unsigned int switches;
+	unsigned int cr3_skipped;	//switches between threads, without TLB flush
+	unsigned int mm_preferred;	//times a thread of the same process is run first
+	unsigned int mm_per_sec;	//address space switches in the last second
+};
+int get_switch_stat(struct switch_stat *buf);
+int set_mm_batch(int n);	//n < 0 only returns the current value, -1 if not allowed
+
+/* cpu accounting, keep the same with LOAD_STAT and TASK_STAT in proc.h.
+ * times are in TSC cycles, and the load averages are fixed-point numbers
+ * with FSHIFT bits of fraction.
+ */
+#define FSHIFT	11
+struct load_stat {
+	unsigned long long tsc;			//when the snapshot is taken
+	unsigned int avenrun[3];		//1, 5 and 15 minutes load averages
+	unsigned int idle_pct;			//idle percentage in the last second
+	unsigned int nr_ready;
+};
+struct task_stat {
+	int pid;
+	int ppid;
+	char name[16];
+	int stat;
+	int type;
+	unsigned long long utime;
+	unsigned long long stime;
+	unsigned int nvcsw;				//switches by sleeping or exiting
+	unsigned int nivcsw;			//switches by being preempted or yielding
+	unsigned int nsyscalls;
+};
+int get_task_stat(struct task_stat *buf, int n, struct load_stat *load);	//number of tasks in buf
+
+/* nanosecond clock since boot, keep the same with const.h and TIMESPEC in proc.h */
+#define CLOCK_MONOTONIC	1
+struct timespec {
+	unsigned int tv_sec;
+	unsigned int tv_nsec;
+};
+int clock_gettime(int clock_id, struct timespec *ts);	//-1 if clock_id isn't supported
+
+/* futex operations, keep the same with proc.h */
+#define FUTEX_WAIT		0	//sleep if *uaddr is still val
+#define FUTEX_WAKE		1	//wake up at most val sleepers
+int futex(int *uaddr, int op, int val);
+
+/*usync.c, thread synchronization without syscalls when uncontended*/
+typedef struct {
+	volatile int state;
+} pthread_mutex_t;
+
+typedef struct {
+	volatile int seq;
+} pthread_cond_t;
+
+typedef struct {
+	int count;
+	volatile int waiting;
+	volatile int phase;
+} pthread_barrier_t;
+
+void pthread_mutex_init(pthread_mutex_t *mutex);
+void pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);	//0 if got, -1 if locked
+void pthread_mutex_unlock(pthread_mutex_t *mutex);
+void pthread_cond_init(pthread_cond_t *cond);
+void pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+void pthread_cond_signal(pthread_cond_t *cond);
+void pthread_cond_broadcast(pthread_cond_t *cond);
+void pthread_barrier_init(pthread_barrier_t *barrier, int count);
+int pthread_barrier_wait(pthread_barrier_t *barrier);	//1 in the last thread
+
+/*umalloc.c, the heap allocator, small blocks without syscalls*/
+void* malloc(int size);		//0 if there is no more heap
+void free(void *ptr);
+int brk(void *addr);		//0, or -1
+
 /*string.asm*/
 void* memcpy(void* p_dst, void*  p_src, int size);//void* memcpy(void* es:p_dst, void* ds:p_src, int size);
 void memset(void* p_dst, char ch, int size);
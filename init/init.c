@@ -183,6 +183,418 @@ void main(int arg,char *argv[])
 }
 //	*/
 
+/*======================================================================*
+                        Scheduler Histogram Tool
+ print the log2 histograms of all processes every 100 ticks, a line
+ "2^i:n" for each non-empty bucket.
+ *======================================================================*/
+	/*
+void show_hist(char *name, unsigned int *bucket)
+{
+	int i;
+	
+	udisp_str(name);
+	for (i = 0; i < NR_HIST_BUCKETS; i++) {
+		if (bucket[i] == 0)
+			continue;
+		udisp_str(" 2^");
+		udisp_int(i);
+		udisp_str(":");
+		udisp_int(bucket[i]);
+	}
+	udisp_str("\n");
+}
+
+void main(int arg,char *argv[])
+{
+	struct sched_hist hist;
+	
+	while(1)
+	{
+		get_sched_hist(-1, &hist);
+		show_hist("wakeup", hist.wakeup);
+		show_hist("rq_delay", hist.rq_delay);
+		show_hist("slice", hist.slice);
+		sleep(100);
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                           Slab Stat Tool
+ print the kernel object caches every 100 ticks, a line
+ "name size active/total allocs" for each.
+ *======================================================================*/
+	/*
+void main(int arg,char *argv[])
+{
+	struct slab_stat stat;
+	int i;
+	
+	while(1)
+	{
+		for (i = 0; get_slab_stat(i, &stat) == 0; i++) {
+			udisp_str(stat.name);
+			udisp_str(" ");
+			udisp_int(stat.obj_size);
+			udisp_str(" ");
+			udisp_int(stat.active);
+			udisp_str("/");
+			udisp_int(stat.total);
+			udisp_str(" ");
+			udisp_int(stat.allocs);
+			udisp_str("\n");
+		}
+		sleep(100);
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                           COW Fork Test
+ the child writes a global shared by fork, which copies the page, and
+ the parent must still see its own value after reaping the child.
+ *======================================================================*/
+	/*
+int cow_value = 1;
+
+void main(int arg,char *argv[])
+{
+	int status;
+	
+	if (fork() == 0) {
+		cow_value = 2;
+		exit(cow_value);
+	}
+	wait(&status);
+	udisp_str("child ");
+	udisp_int(status);
+	udisp_str(" parent ");
+	udisp_int(cow_value);	//still 1
+	udisp_str("\n");
+	while(1)
+	{
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                          Demand Zero Test
+ a 64M malloc only reserves the heap, each touched page gets a zeroed
+ frame on its first fault.
+ *======================================================================*/
+	/*
+void main(int arg,char *argv[])
+{
+	char *big = (char*)malloc(0x4000000);
+	int i, nonzero = 0;
+	
+	for (i = 0; i < 0x4000000; i += 0x100000) {
+		if (big[i] != 0)
+			nonzero++;
+		big[i] = 1;
+	}
+	udisp_str("nonzero ");
+	udisp_int(nonzero);		//0
+	udisp_str("\n");
+	while(1)
+	{
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                             Malloc Test
+ two threads malloc and free small blocks in their own arenas, the heap
+ only grows by a few runs, and a large block is given back by free().
+ *======================================================================*/
+	/*
+void malloc_worker()
+{
+	char *p[64];
+	int i, round;
+	
+	for (round = 0; round < 1000; round++) {
+		for (i = 0; i < 64; i++)
+			p[i] = malloc(8 + i * 16);
+		for (i = 0; i < 64; i++)
+			free(p[i]);
+	}
+	while(1)
+	{
+	}
+}
+
+void main(int arg,char *argv[])
+{
+	char *start = sbrk(0);
+	char *big;
+	
+	pthread(malloc_worker);
+	sleep(100);
+	big = malloc(0x100000);
+	udisp_str("heap ");
+	udisp_int((char*)sbrk(0) - start);
+	free(big);
+	udisp_str(" after free ");
+	udisp_int((char*)sbrk(0) - start);
+	udisp_str("\n");
+	while(1)
+	{
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                          Mutex Fork Test
+ a thread sleeps on a mutex held by main, which forks and then unlocks it.
+ unlocking writes the shared page, so the word moves to a new frame, and
+ the thread must still be woken.
+ *======================================================================*/
+	/*
+pthread_mutex_t fork_mutex;
+
+void fork_waiter()
+{
+	pthread_mutex_lock(&fork_mutex);
+	udisp_str("woken ");
+	pthread_mutex_unlock(&fork_mutex);
+	exit(0);
+}
+
+void main(int arg,char *argv[])
+{
+	int tid, pid, status;
+	
+	pthread_mutex_init(&fork_mutex);
+	pthread_mutex_lock(&fork_mutex);
+	tid = pthread(fork_waiter);
+	sleep(10);		//the thread sleeps on the mutex now
+	pid = fork();
+	if(pid == 0)
+	{
+		exit(0);
+	}
+	pthread_mutex_unlock(&fork_mutex);
+	pthread_join(tid, &status);
+	wait(&status);
+	udisp_str("mutex fork test ok ");
+	while(1)
+	{
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                          Pthread Sync Test
+ a producer and a consumer thread share a counter guarded by a mutex and
+ a condition variable, instead of waiting in busy loops.
+ *======================================================================*/
+	/*
+pthread_mutex_t sync_mutex;
+pthread_cond_t sync_cond;
+int sync_count = 0;
+
+void sync_producer()
+{
+	while(1)
+	{
+		pthread_mutex_lock(&sync_mutex);
+		sync_count++;
+		pthread_cond_signal(&sync_cond);
+		pthread_mutex_unlock(&sync_mutex);
+		sleep(10);
+	}
+}
+
+void main(int arg,char *argv[])
+{
+	int seen = 0;
+	
+	pthread_mutex_init(&sync_mutex);
+	pthread_cond_init(&sync_cond);
+	pthread(sync_producer);
+	while(1)
+	{
+		pthread_mutex_lock(&sync_mutex);
+		while(sync_count == seen)
+			pthread_cond_wait(&sync_cond, &sync_mutex);
+		seen = sync_count;
+		pthread_mutex_unlock(&sync_mutex);
+		udisp_str("got ");
+		udisp_int(seen);
+		udisp_str(" ");
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                          Exit and Wait Test
+ children and threads are created and reaped over and over, so the free
+ memory shouldn't go down as the loop goes on.
+ *======================================================================*/
+	/*
+void exit_thread()
+{
+	exit(7);
+}
+
+void main(int arg,char *argv[])
+{
+	int pid, tid, status;
+	
+	while(1)
+	{
+		pid = fork();
+		if(pid == 0)
+			exit(get_pid());
+		pid = wait(&status);
+		udisp_str("reaped ");
+		udisp_int(pid);
+		udisp_str(":");
+		udisp_int(status);
+		
+		tid = pthread(exit_thread);
+		pthread_join(tid, &status);
+		udisp_str(" joined ");
+		udisp_int(status);
+		udisp_str(" ");
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                               Top Tool
+ print the cpu usage of every task in the last second, with the load
+ averages and the idle percentage. two busy children make some load.
+ *======================================================================*/
+	/*
+#define TOP_TASKS	32
+
+struct task_stat top_cur[TOP_TASKS];
+int top_prev_pid[TOP_TASKS];
+unsigned long long top_prev_cycles[TOP_TASKS];	//utime + stime a second ago
+int top_nprev = 0;
+
+//a * 100 / b without 64-bit division, which ulib doesn't have
+int top_pct(unsigned long long a, unsigned long long b)
+{
+	while ((b >> 24) != 0) {
+		a >>= 1;
+		b >>= 1;
+	}
+	return b == 0 ? 0 : (unsigned int)a * 100 / (unsigned int)b;
+}
+
+unsigned long long top_cycles(int pid)
+{
+	int i;
+	
+	for (i = 0; i < top_nprev; i++) {
+		if (top_prev_pid[i] == pid)
+			return top_prev_cycles[i];
+	}
+	return 0;
+}
+
+void top_load(unsigned int load)
+{
+	udisp_int(load >> FSHIFT);
+	udisp_str(".");
+	udisp_int(((load & ((1 << FSHIFT) - 1)) * 100) >> FSHIFT);
+	udisp_str(" ");
+}
+
+void main(int arg,char *argv[])
+{
+	struct load_stat load;
+	unsigned long long prev_tsc = 0;
+	int i, n;
+	
+	for (i = 0; i < 2; i++) {
+		if (fork() == 0)
+			while(1) {}
+	}
+	
+	while(1)
+	{
+		n = get_task_stat(top_cur, TOP_TASKS, &load);
+		udisp_str("\nload ");
+		for (i = 0; i < 3; i++)
+			top_load(load.avenrun[i]);
+		udisp_str("ready ");
+		udisp_int(load.nr_ready);
+		udisp_str(" idle ");
+		udisp_int(load.idle_pct);
+		udisp_str("%\n");
+		
+		for (i = 0; i < n && prev_tsc != 0; i++) {
+			udisp_int(top_cur[i].pid);
+			udisp_str(" ");
+			udisp_str(top_cur[i].name);
+			udisp_str(" cpu ");
+			udisp_int(top_pct(top_cur[i].utime + top_cur[i].stime - top_cycles(top_cur[i].pid),
+							  load.tsc - prev_tsc));
+			udisp_str("% csw ");
+			udisp_int(top_cur[i].nvcsw);
+			udisp_str("/");
+			udisp_int(top_cur[i].nivcsw);
+			udisp_str(" sys ");
+			udisp_int(top_cur[i].nsyscalls);
+			udisp_str("\n");
+		}
+		
+		for (i = 0; i < n; i++) {
+			top_prev_pid[i] = top_cur[i].pid;
+			top_prev_cycles[i] = top_cur[i].utime + top_cur[i].stime;
+		}
+		top_nprev = n;
+		prev_tsc = load.tsc;
+		sleep(100);
+	}
+	return ;
+}
+//	*/
+
+/*======================================================================*
+                              Clock Test
+ print how many microseconds sleep(1) and a yield() really take.
+ *======================================================================*/
+	/*
+int clock_us(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000 + ((int)b->tv_nsec - (int)a->tv_nsec) / 1000;
+}
+
+void main(int arg,char *argv[])
+{
+	struct timespec t0, t1, t2;
+	
+	while(1)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		sleep(1);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		yield();
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		udisp_str("sleep(1) ");
+		udisp_int(clock_us(&t0, &t1));
+		udisp_str("us yield ");
+		udisp_int(clock_us(&t1, &t2));
+		udisp_str("us\n");
+	}
+	return ;
+}
+//	*/
+
 /*======================================================================*
                            File System Test
 added by xw, 18/6/19
@@ -242,7 +654,10 @@ void main(int arg,char *argv[])
 
 	close(fd);
 	
+	//orphans are given to init, which reaps them
 	while (1) {
+		if (wait(0) == -1)
+			sleep(10);
 	}
 	
 	return;
@@ -13,13 +13,41 @@
 #include "global.h"
 #include "proto.h"
 
+PRIVATE int tick_stopped = 0;	//1 if the periodic tick is replaced by a one-shot timer
+PRIVATE int oneshot_ticks;		//number of ticks the one-shot timer covers
+
+PRIVATE int stat_sec_start;		//ticks when switch_stat.mm_per_sec was updated
+PRIVATE u32 stat_sec_mm;		//cr3 reloads counted until then
+
+PRIVATE int load_start;			//ticks when load_stat.avenrun was updated
+PRIVATE int idle_sec_start;		//ticks when load_stat.idle_pct was updated
+PRIVATE u64 idle_sec_tsc;		//TSC then
+PRIVATE u64 idle_sec_cycles;	//cycles the idle task had run until then
+
+PRIVATE void timer_periodic(u32 first);
+PRIVATE void update_switch_rate();
+PRIVATE void update_load_avg();
+PRIVATE void update_idle_pct();
+
 
 /*======================================================================*
                            clock_handler
  *======================================================================*/
 PUBLIC void clock_handler(int irq)
 {
-	ticks++;
+	if(tick_stopped){
+		//the one-shot timer programmed by tick_nohz_enter() has fired
+		ticks += oneshot_ticks;
+		idle_stat.ticks_skipped += oneshot_ticks - 1;
+		tick_stopped = 0;
+		timer_periodic(TIMER_COUNT);
+	}else{
+		ticks++;
+	}
+	run_timers();
+	update_switch_rate();
+	update_load_avg();
+	update_idle_pct();
 	
 	/* There is two stages - in kernel intializing or in process running.
 	 * Some operation shouldn't be valid in kernel intializing stage.
@@ -30,7 +58,10 @@ PUBLIC void clock_handler(int irq)
 	}
 	
 	p_proc_current->task.ticks--;
-	sys_wakeup(&ticks);
+	//give schedule() a chance to preempt the current process every tick
+	resched_curr();
+	//sleeping processes are woken by their own timer in run_timers(), 
+	//sys_wakeup(&ticks) isn't needed any more.
 
 	//to make syscall reenter, deleted by xw, 17/12/11
 	/*
@@ -53,13 +84,258 @@ PUBLIC void clock_handler(int irq)
 //	sched();
 }
 
+//address space switches per second, a one-shot tick may cover several seconds
+PRIVATE void update_switch_rate()
+{
+	u32 mm = switch_stat.switches - switch_stat.cr3_skipped;
+	int elapsed = ticks - stat_sec_start;
+	
+	if (elapsed < HZ)
+		return;
+	switch_stat.mm_per_sec = (mm - stat_sec_mm) * HZ / elapsed;
+	stat_sec_mm = mm;
+	stat_sec_start = ticks;
+}
+
+/*======================================================================*
+                              cpu load
+ *======================================================================*/
+#define calc_load(load, exp, n)	(((load) * (exp) + (n) * (FIXED_1 - (exp))) >> FSHIFT)
+
+/* the load averages decay every LOAD_FREQ ticks. a one-shot tick may cover
+ * several periods, in which the cpu was idle and nothing was READY.
+ */
+PRIVATE void update_load_avg()
+{
+	int periods = (ticks - load_start) / LOAD_FREQ;
+	u32 active = 0;
+	
+	if (periods <= 0)
+		return;
+	load_start += periods * LOAD_FREQ;
+	if (periods > 1024)
+		periods = 1024;		//all of them have decayed to 0 long before
+	while (periods-- > 0) {
+		if (periods == 0) {
+			load_stat.nr_ready = nr_ready_procs();
+			active = load_stat.nr_ready * FIXED_1;
+		}
+		load_stat.avenrun[0] = calc_load(load_stat.avenrun[0], EXP_1, active);
+		load_stat.avenrun[1] = calc_load(load_stat.avenrun[1], EXP_5, active);
+		load_stat.avenrun[2] = calc_load(load_stat.avenrun[2], EXP_15, active);
+	}
+}
+
+//idle percentage of the last second, from the cycles the idle task has run
+PRIVATE void update_idle_pct()
+{
+	PROCESS *idle = &cpu_table[0];
+	u64 now, cycles, total, busy_idle;
+	
+	if (ticks - idle_sec_start < HZ)
+		return;
+	now = read_tsc();
+	cycles = idle_stat.idle_cycles;
+	if (p_proc_current == idle && idle->task.run_tsc != 0)
+		cycles += now - idle->task.run_tsc;	//it's running now
+	
+	if (idle_sec_tsc != 0) {
+		total = now - idle_sec_tsc;
+		busy_idle = cycles - idle_sec_cycles;
+		//no 64-bit division in the kernel, scale both down first
+		while ((total >> 24) != 0) {
+			total >>= 1;
+			busy_idle >>= 1;
+		}
+		if (total != 0)
+			load_stat.idle_pct = (u32)busy_idle * 100 / (u32)total;
+	}
+	idle_sec_tsc = now;
+	idle_sec_cycles = cycles;
+	idle_sec_start = ticks;
+}
+
+/*======================================================================*
+                           tickless idle
+ *======================================================================*/
+/* restart counter0 in rate generator mode. the first interrupt comes after
+ * first counts, and the following ones come every TIMER_COUNT counts.
+ */
+PRIVATE void timer_periodic(u32 first)
+{
+	if(first < 2 || first > TIMER_COUNT)
+		first = TIMER_COUNT;
+	
+	out_byte(TIMER_MODE, RATE_GENERATOR);
+	out_byte(TIMER0, (u8) first);
+	out_byte(TIMER0, (u8) (first >> 8));
+	if(first != TIMER_COUNT){
+		//a new count written while counting is loaded at the end of current period
+		out_byte(TIMER0, (u8) TIMER_COUNT);
+		out_byte(TIMER0, (u8) (TIMER_COUNT >> 8));
+	}
+}
+
+/* called by schedule() with interrupt disabled when the idle task is chosen.
+ * the periodic tick is stopped and a one-shot timer is programmed to fire at
+ * the earliest timer in the timer wheel, so an idle cpu isn't woken HZ times
+ * a second.
+ */
+PUBLIC void tick_nohz_enter()
+{
+	int delta;
+	u32 count;
+	
+	if(!TICKLESS_IDLE || tick_stopped)
+		return;
+	
+	delta = timer_next_expiry(MAX_IDLE_TICKS);
+	if(delta <= 1)
+		return;		//the next periodic tick is needed anyway
+	
+	//don't stop the tick if a clock interrupt is pending in 8259A
+	out_byte(INT_M_CTL, 0x0A);	//OCW3, read IRR
+	if(in_byte(INT_M_CTL) & (1 << CLOCK_IRQ))
+		return;
+	
+	//keep the remaining counts of current tick, so the one-shot timer
+	//expires right at a tick boundary and no time is lost.
+	out_byte(TIMER_MODE, TIMER_LATCH);
+	count = in_byte(TIMER0);
+	count |= in_byte(TIMER0) << 8;
+	count += (delta - 1) * TIMER_COUNT;
+	
+	out_byte(TIMER_MODE, TIMER_ONESHOT);
+	out_byte(TIMER0, (u8) count);
+	out_byte(TIMER0, (u8) (count >> 8));
+	
+	oneshot_ticks = delta;
+	tick_stopped = 1;
+	idle_stat.oneshot_count++;
+}
+
+/* called by schedule() with interrupt disabled when a process is chosen.
+ * if the one-shot timer hasn't fired yet, which means the idle task was
+ * interrupted by other devices, account the ticks that have passed and
+ * restart the periodic tick at the next tick boundary.
+ */
+PUBLIC void tick_nohz_exit()
+{
+	u32 status, count, left;
+	
+	if(!tick_stopped)
+		return;
+	
+	out_byte(TIMER_MODE, TIMER_READBACK);
+	status = in_byte(TIMER0);
+	count = in_byte(TIMER0);
+	count |= in_byte(TIMER0) << 8;
+	if(status & TIMER_OUT)
+		return;		//it has fired, clock_handler will account the ticks
+	
+	//tick boundaries not passed yet, including the one the timer expires at
+	left = (count + TIMER_COUNT - 1) / TIMER_COUNT;
+	ticks += oneshot_ticks - left;
+	idle_stat.ticks_skipped += oneshot_ticks - left;
+	tick_stopped = 0;
+	timer_periodic(count - (left - 1) * TIMER_COUNT);
+}
+
+/*======================================================================*
+                           monotonic clock
+ *======================================================================*/
+/* TSC cycles are turned into ns by ns = cycles * tsc_mult >> TSC_SHIFT,
+ * so no 64-bit division is needed when the clock is read.
+ */
+#define TSC_SHIFT	22
+
+PRIVATE u32 tsc_khz;			//0 if the TSC isn't calibrated, then ticks are used
+PRIVATE u32 tsc_mult;
+PRIVATE u64 tsc_base;			//TSC at calibration, the clock starts from 0 then
+
+/* n / d for a 64-bit n, since there is no libgcc. the remainder is stored
+ * in *rem if rem isn't 0.
+ */
+PUBLIC u64 div_u64_rem(u64 n, u32 d, u32 *rem)
+{
+	u32 hi = (u32)(n >> 32);
+	u32 q_hi = hi / d;
+	u32 q_lo, r;
+	
+	hi %= d;	//so the quotient of divl fits in 32 bits
+	asm ("divl %4" : "=a"(q_lo), "=d"(r) : "a"((u32)n), "d"(hi), "rm"(d));
+	if (rem != 0)
+		*rem = r;
+	return ((u64)q_hi << 32) | q_lo;
+}
+
+/* called by kernel_main() with interrupt disabled, before counter0 starts.
+ * counter2 counts down CALIBRATE_MS milliseconds, and the TSC cycles passed
+ * meanwhile give its frequency.
+ */
+PUBLIC void calibrate_tsc()
+{
+	u32 count = TIMER_FREQ * CALIBRATE_MS / 1000;
+	u32 gate = in_byte(TIMER2_GATE);
+	u32 loops;
+	u64 start, end;
+	
+	out_byte(TIMER2_GATE, (gate & ~0x02) | 0x01);	//counter2 on, speaker off
+	out_byte(TIMER_MODE, TIMER2_ONESHOT);
+	out_byte(TIMER2, (u8) count);
+	out_byte(TIMER2, (u8) (count >> 8));
+	
+	start = read_tsc();
+	for (loops = 0; loops < 0x1000000; loops++) {
+		if (in_byte(TIMER2_GATE) & TIMER2_OUT)
+			break;
+	}
+	end = read_tsc();
+	out_byte(TIMER2_GATE, gate);
+	
+	if (loops == 0x1000000 || end - start < CALIBRATE_MS * 1000)
+		return;		//no counter2, or a TSC slower than 1 MHz
+	tsc_khz = (u32)(end - start) / CALIBRATE_MS;
+	tsc_mult = (u32)div_u64_rem((u64)NSEC_PER_MSEC << TSC_SHIFT, tsc_khz, 0);
+	tsc_base = end;
+}
+
+//nanoseconds since boot, can be called in any context
+PUBLIC u64 ktime_get_ns()
+{
+	u64 cycles;
+	
+	if (tsc_khz == 0)
+		return (u64)ticks * (NSEC_PER_SEC / HZ);
+	cycles = read_tsc() - tsc_base;
+	return (((u64)(u32)(cycles >> 32) * tsc_mult) << (32 - TSC_SHIFT)) +
+		   (((u64)(u32)cycles * tsc_mult) >> TSC_SHIFT);
+}
+
+/* store the time of clock_id in ts as seconds and nanoseconds.
+ * return 0, or -1 if clock_id isn't CLOCK_MONOTONIC.
+ */
+PUBLIC int sys_clock_gettime(void *uesp)
+{
+	int clock_id = get_arg(uesp, 1);
+	TIMESPEC *ts = (TIMESPEC*)get_arg(uesp, 2);
+	u32 nsec;
+	
+	if (clock_id != CLOCK_MONOTONIC || ts == 0)
+		return -1;
+	ts->tv_sec = (u32)div_u64_rem(ktime_get_ns(), NSEC_PER_SEC, &nsec);
+	ts->tv_nsec = nsec;
+	return 0;
+}
+
 /*======================================================================*
                               milli_delay
  *======================================================================*/
+//busy wait on the monotonic clock, so it works before the clock interrupt is on
 PUBLIC void milli_delay(int milli_sec)
 {
-        int t = get_ticks();
-
-        while(((get_ticks() - t) * 1000 / HZ) < milli_sec) {}
+	u64 start = ktime_get_ns();
+	
+	while (ktime_get_ns() - start < (u64)milli_sec * NSEC_PER_MSEC) {}
 }
 
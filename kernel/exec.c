@@ -14,6 +14,8 @@
 
 PRIVATE u32 exec_elfcpy(u32 fd,Elf32_Phdr Echo_Phdr,u32 attribute);
 PRIVATE u32 exec_load(u32 fd,const Elf32_Ehdr* Echo_Ehdr,const Elf32_Phdr Echo_Phdr[]);
+PRIVATE void exec_protect_text();
+PRIVATE int exec_check(const Elf32_Ehdr* Echo_Ehdr,const Elf32_Phdr Echo_Phdr[]);
 PRIVATE int exec_pcb_init(char* path);
 
 
@@ -27,9 +29,9 @@ PUBLIC u32 sys_exec(char *path)
 	Elf32_Ehdr Echo_Ehdr;
 	Elf32_Phdr Echo_Phdr[10];
 	Elf32_Shdr Echo_Shdr[10];
-	u32 addr_lin;
-	u32 err_temp;
 	u32 pde_addr_phy,addr_phy_temp;
+	char name[16];	//path is in the user memory, which is released below
+	u32 i;
 	
 	char* p_reg;	//point to a register in the new kernel stack, added by xw, 17/12/11
 
@@ -38,6 +40,9 @@ PUBLIC u32 sys_exec(char *path)
 		disp_color_str("exec: path ERROR!",0x74);
 		return -1;
 	}
+	for( i=0 ; i<sizeof(name)-1 && path[i]!=0 ; i++ )
+		name[i] = path[i];
+	name[i] = 0;
 	
 	/*******************打开文件************************/
 	// u32 fd = open(path,"r"); 
@@ -45,15 +50,28 @@ PUBLIC u32 sys_exec(char *path)
 	
 	/*************获取elf信息**************/
 	read_elf(fd,&Echo_Ehdr,Echo_Phdr,Echo_Shdr);//注意第一个取了地址，后两个是数组，所以没取地址，直接用了数组名
+	
+	//the old program is still there to return to, so check the new one before releasing it
+	if(-1==exec_check(&Echo_Ehdr,Echo_Phdr))
+	{
+		disp_color_str("exec: elf ERROR!",0x74);
+		return -1;
+	}
 		
 	/*************释放进程内存****************/
-	//目前还没有实现 思路是：数据、代码根据text_info和data_info属性决定释放深度，其余内存段可以完全释放
+	//数据、代码根据text_hold和data_hold属性决定释放深度，其余内存段完全释放, see exit.c
+	//a fork child only unmaps the text it shares, so the new program gets its own frames
+	exit_threads();		//the other threads run in the memory
+	release_user_mem(p_proc_current);
 	
 	/*************根据elf的program复制文件信息**************/
-	if(-1==exec_load(fd,&Echo_Ehdr,Echo_Phdr)) return -1;//使用了const指针传递
+	if((u32)-1==exec_load(fd,&Echo_Ehdr,Echo_Phdr))//使用了const指针传递
+	{
+		sys_exit(-1);	//no memory to return to any more
+	}
 
 	/*****************重新初始化该进程的进程表信息（包括LDT）、线性地址布局、进程树属性********************/	
-	exec_pcb_init(path);	
+	exec_pcb_init(name);	
 	
 	/***********************代码、数据、堆、栈***************************/
 	//代码、数据已经处理，将eip重置即可
@@ -64,25 +82,12 @@ PUBLIC u32 sys_exec(char *path)
 	//栈
 	p_proc_current->task.regs.esp=(u32)p_proc_current->task.memmap.stack_lin_base;			//栈地址最高处
 	*((u32*)(p_reg + ESPREG - P_STACKTOP)) = p_proc_current->task.regs.esp;	//added by xw, 17/12/11
+	//栈只保留线性地址，用到哪页才分配哪页，see demand_zero_fault()
 	
-	for( addr_lin=p_proc_current->task.memmap.stack_lin_base ; addr_lin > p_proc_current->task.memmap.stack_lin_limit ; addr_lin-=num_4K )
-	{
-		err_temp = lin_mapping_phy(	addr_lin,//线性地址						//add by visual 2016.5.9
-									MAX_UNSIGNED_INT,//物理地址						//edit by visual 2016.5.19
-									p_proc_current->task.pid,//进程pid			//edit by visual 2016.5.19
-									PG_P  | PG_USU | PG_RWW,//页目录的属性位
-									PG_P  | PG_USU | PG_RWW);//页表的属性位
-
-		if( err_temp!=0 )
-		{
-			disp_color_str("kernel_main Error:lin_mapping_phy",0x74);
-			return -1;
-		}
-	}
 	//堆    用户还没有申请，所以没有分配，只在PCB表里标示了线性起始位置
 	
 	disp_color_str("[exec success:",0x72);//灰底绿字
-	disp_color_str(path,0x72);//灰底绿字	
+	disp_color_str(name,0x72);//灰底绿字	
 	disp_color_str("]",0x72);//灰底绿字
 	return 0;
 }
@@ -104,6 +109,9 @@ PRIVATE u32 exec_elfcpy(u32 fd,Elf32_Phdr Echo_Phdr,u32 attribute)  // 这部分
 	u8 ch;
 	//u32 pde_addr_phy = get_pde_phy_addr(p_proc_current->task.pid); //页目录物理地址			//delete by visual 2016.5.19
 	//u32 addr_phy = test_malloc(Echo_Phdr.p_memsz);//申请物理内存					//delete by visual 2016.5.19
+	//bss pages after the last page of the file are mapped zero-filled when they are touched
+	if( lin_limit > ((Echo_Phdr.p_vaddr + Echo_Phdr.p_filesz + num_4K - 1) & 0xFFFFF000) )
+		lin_limit = (Echo_Phdr.p_vaddr + Echo_Phdr.p_filesz + num_4K - 1) & 0xFFFFF000;
 	for(  ; lin_addr<lin_limit ; lin_addr++,file_offset++ )
 	{	
 		lin_mapping_phy(lin_addr,MAX_UNSIGNED_INT,p_proc_current->task.pid,PG_P  | PG_USU | PG_RWW/*说明*/,attribute);//说明：PDE属性尽量为读写，因为它要映射1024个物理页，可能既有数据，又有代码	//edit by visual 2016.5.19
@@ -127,6 +135,31 @@ PRIVATE u32 exec_elfcpy(u32 fd,Elf32_Phdr Echo_Phdr,u32 attribute)  // 这部分
 }
 
 
+/*======================================================================*
+*                          exec_check
+*检查elf，exec_load()能否装入
+*======================================================================*/
+//return 0 if it's an elf exec_load() knows, or -1
+PRIVATE int exec_check(const Elf32_Ehdr* Echo_Ehdr,const Elf32_Phdr Echo_Phdr[])
+{
+	u32 ph_num;
+	
+	if( Echo_Ehdr->e_ident[0]!=0x7F || Echo_Ehdr->e_ident[1]!='E' ||
+		Echo_Ehdr->e_ident[2]!='L' || Echo_Ehdr->e_ident[3]!='F' )
+		return -1;
+	if( 0==Echo_Ehdr->e_phnum )
+		return -1;
+	for( ph_num=0; ph_num<Echo_Ehdr->e_phnum ; ph_num++ )
+	{
+		if( 0==Echo_Phdr[ph_num].p_memsz )
+			break;
+		if( Echo_Phdr[ph_num].p_flags!=0x5 && Echo_Phdr[ph_num].p_flags!=0x6 )
+			return -1;	//the same programs as exec_load() takes
+	}
+	return 0;
+}
+
+
 /*======================================================================*
 *                          exec_load		add by visual 2016.5.23
 *根据elf的program复制文件信息
@@ -150,7 +183,9 @@ PRIVATE u32 exec_load(u32 fd,const Elf32_Ehdr* Echo_Ehdr,const Elf32_Phdr Echo_P
 		}
 		if( Echo_Phdr[ph_num].p_flags == 0x5 ) //101，只读
 		{//.text
-			exec_elfcpy(fd,Echo_Phdr[ph_num],PG_P  | PG_USU | PG_RWR);//进程代码段
+			//CR0.WP is set, so the kernel can't write a read-only page either. it's
+			//mapped read-write to be loaded, and protected by exec_protect_text()
+			exec_elfcpy(fd,Echo_Phdr[ph_num],PG_P  | PG_USU | PG_RWW);//进程代码段
 			p_proc_current->task.memmap.text_lin_base = Echo_Phdr[ph_num].p_vaddr;	
 			p_proc_current->task.memmap.text_lin_limit = Echo_Phdr[ph_num].p_vaddr + Echo_Phdr[ph_num].p_memsz;
 		}
@@ -166,9 +201,30 @@ PRIVATE u32 exec_load(u32 fd,const Elf32_Ehdr* Echo_Ehdr,const Elf32_Phdr Echo_P
 			return -1;
 		}
 	}
+	exec_protect_text();
 	return 0;
 }
 
+/* make the text pages read-only after they are loaded. a page which has
+ * data too stays writable.
+ */
+PRIVATE void exec_protect_text()
+{
+	LIN_MEMMAP *m = &p_proc_current->task.memmap;
+	u32 pid = p_proc_current->task.pid;
+	u32 addr_lin;
+	
+	for( addr_lin = m->text_lin_base & 0xFFFFF000 ; addr_lin < m->text_lin_limit ; addr_lin += num_4K )
+	{
+		if( addr_lin + num_4K > m->data_lin_base && addr_lin < m->data_lin_limit )
+			continue;
+		if( 0==pte_exist(get_pde_phy_addr(pid),addr_lin) || 0==phy_exist(get_pte_phy_addr(pid,addr_lin),addr_lin) )
+			continue;	//not loaded from the file
+		*((u32*)K_PHY2LIN(get_pte_phy_addr(pid,addr_lin)) + get_pte_index(addr_lin)) &= ~PG_RWW;
+		invlpg(addr_lin);
+	}
+}
+
 
 /*======================================================================*
 *                          exec_init		add by visual 2016.5.23
@@ -180,6 +236,7 @@ PRIVATE int exec_pcb_init(char* path)
 	
 	//名称 状态 特权级 寄存器
 	strcpy(p_proc_current->task.p_name, path);		//名称
+	fpu_release(p_proc_current);					//the new program starts with a clean FPU state
 	p_proc_current->task.stat = READY;  						//状态
 	p_proc_current->task.ldts[0].attr1 = DA_C | PRIVILEGE_USER << 5;//特权级修改为用户级
 	p_proc_current->task.ldts[1].attr1 = DA_DRW | PRIVILEGE_USER << 5;//特权级修改为用户级
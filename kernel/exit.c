@@ -0,0 +1,361 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               exit.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Exit of processes and threads, and reaping them.
+  exit() only makes the caller a ZOMBIE and wakes up its reaper, since
+  its kernel stack is in use until sched() switches away. The memory
+  and the PCB are freed by the reaper: wait() in the parent for a
+  process, and pthread_join() in the same process for a thread. A
+  process is reaped only after all of its threads have exited, for they
+  run in its address space, so its threads are killed when it exits.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+//KILLED by an exception or exited, it's waiting to be reaped
+#define proc_dead(p)	((p)->task.stat == ZOMBIE || (p)->task.stat == KILLED)
+
+//the reapers of p's children sleep on this channel
+#define child_channel(p)	((void*)&(p)->task.info)
+
+//1 if a thread of process p is still alive
+PRIVATE int live_threads(PROCESS *p)
+{
+	PROCESS *c;
+
+	for (c = p->task.info.child_list; c != 0; c = c->task.info.sibling) {
+		if (c->task.info.type == TYPE_THREAD && !proc_dead(c))
+			return 1;
+	}
+	return 0;
+}
+
+//unlink child from the child list of parent. interrupt must be disabled.
+PRIVATE void del_child(PROCESS *parent, PROCESS *child)
+{
+	PROCESS **pp;
+
+	for (pp = &parent->task.info.child_list; *pp != 0; pp = &(*pp)->task.info.sibling) {
+		if (*pp == child) {
+			*pp = child->task.info.sibling;
+			child->task.info.sibling = 0;
+			return;
+		}
+	}
+}
+
+/* make the live threads of process p exit, for p is exiting or exec'ing. a
+ * thread sleeping on a channel, in futex(), sleep(), wait() or
+ * pthread_join(), holds nothing in the kernel and exits at once. the others
+ * may be in a syscall holding a lock, so they are only marked, and exit
+ * before going back to ring 3, see exit_killed(). interrupt must be disabled.
+ */
+PRIVATE void kill_threads(PROCESS *p)
+{
+	PROCESS *c;
+
+	for (c = p->task.info.child_list; c != 0; c = c->task.info.sibling) {
+		if (c->task.info.type != TYPE_THREAD || proc_dead(c))
+			continue;
+		c->task.killed = 1;
+		if (c->task.stat == SLEEPING && c->task.channel != 0) {
+			stop_proc(c);
+			exit_proc(c, -1);
+		}
+	}
+}
+
+/*======================================================================*
+                               exit_proc
+ *======================================================================*/
+/* make p a ZOMBIE with status, can be called in any context. its child
+ * processes are given to init, and the threads stay with p until they are
+ * reaped with it, since they use its memory.
+ */
+PUBLIC void exit_proc(PROCESS *p, int status)
+{
+	PROCESS *parent = pid2proc(p->task.info.ppid);
+	PROCESS *init = pid2proc(INIT_PID);
+	PROCESS *c, *next, *threads = 0;
+	u32 eflags = disable_int_save();
+
+	p->task.exit_status = status;
+	p->task.stat = ZOMBIE;
+
+	if (init != 0 && init != p) {
+		for (c = p->task.info.child_list; c != 0; c = next) {
+			next = c->task.info.sibling;
+			if (c->task.info.type == TYPE_THREAD) {
+				c->task.info.sibling = threads;
+				threads = c;
+				continue;
+			}
+			c->task.info.ppid = INIT_PID;
+			init->task.info.child_p_num++;
+			add_child(init, c);
+		}
+		p->task.info.child_list = threads;
+		p->task.info.child_p_num = 0;
+		sys_wakeup(child_channel(init));	//some of them may have exited already
+	}
+	if (p->task.info.type == TYPE_PROCESS)
+		kill_threads(p);
+
+	if (parent != 0) {
+		sys_wakeup(child_channel(parent));
+		//the last thread of a dead process makes the process reapable
+		if (p->task.info.type == TYPE_THREAD && proc_dead(parent) &&
+			pid2proc(parent->task.info.ppid) != 0)
+			sys_wakeup(child_channel(pid2proc(parent->task.info.ppid)));
+	}
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           release_user_mem
+ *======================================================================*/
+//the frame addr is mapped to in p's page directory, or 0 if none
+PRIVATE u32 mapped_phy(PROCESS *p, u32 addr)
+{
+	if (p->task.cr3 == 0 || 0 == pte_exist(p->task.cr3 & 0xFFFFF000, addr))
+		return 0;
+	if (0 == phy_exist(get_pte_phy_addr(p->task.pid, addr), addr))
+		return 0;
+	return get_page_phy_addr(p->task.pid, addr);
+}
+
+/* a fork child maps the text frames of its parent without owning them. if
+ * p owns its text and another process still maps the same frames, hand
+ * the text over to it instead of freeing the frames. return 1 if so.
+ */
+PRIVATE int give_text(PROCESS *p)
+{
+	u32 base = p->task.memmap.text_lin_base;
+	u32 phy = mapped_phy(p, base);
+	PROCESS *q;
+	int pid;
+
+	if (phy == 0)
+		return 0;
+	for (pid = 0; pid < NR_PIDS; pid++) {
+		q = pid2proc(pid);
+		if (q == 0 || q == p || q->task.info.type != TYPE_PROCESS || q->task.info.text_hold)
+			continue;
+		if (q->task.memmap.text_lin_base == base && mapped_phy(q, base) == phy) {
+			q->task.info.text_hold = 1;
+			p->task.info.text_hold = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* unmap the user memory of process p region by region as its LIN_MEMMAP
+ * says, and give the frames it owns back to memman. text is owned only if
+ * text_hold, data only if data_hold, and the other regions always. the
+ * page tables stay, see free_page_dir(). return -1 if p is a thread.
+ */
+PUBLIC int release_user_mem(PROCESS *p)
+{
+	LIN_MEMMAP *m = &p->task.memmap;
+	u32 pde_phy = p->task.cr3 & 0xFFFFF000;
+	int text_hold = p->task.info.text_hold;
+
+	if (p->task.info.type != TYPE_PROCESS || pde_phy == 0)
+		return -1;
+	if (text_hold && give_text(p))
+		text_hold = 0;
+
+	//data goes before text: where they share a page, fork has copied it as data
+	unmap_lin_range(pde_phy, m->data_lin_base, m->data_lin_limit, p->task.info.data_hold);
+	unmap_lin_range(pde_phy, m->vpage_lin_base, m->vpage_lin_limit, 1);
+	unmap_lin_range(pde_phy, m->heap_lin_base, m->heap_lin_limit, 1);
+	unmap_lin_range(pde_phy, StackLinLimitMAX, m->stack_child_limit, 1);	//stacks of the threads
+	unmap_lin_range(pde_phy, (m->stack_lin_limit + num_4K - 1) & 0xFFFFF000, m->stack_lin_base + 1, 1);
+	unmap_lin_range(pde_phy, m->arg_lin_base, m->arg_lin_limit, 1);
+	unmap_lin_range(pde_phy, m->text_lin_base, m->text_lin_limit, text_hold);
+	unmap_lin_range(pde_phy, SharePageBase, SharePageLimit, 0);	//left by older forks, cow_fault() unmaps its own
+	return 0;
+}
+
+/*======================================================================*
+                                 reap
+ *======================================================================*/
+//t is dead and unlinked from its process. free its stack and PCB
+PRIVATE void reap_thread(PROCESS *t)
+{
+	LIN_MEMMAP *m = &t->task.memmap;
+
+	unmap_lin_range(t->task.cr3 & 0xFFFFF000, (m->stack_lin_limit + num_4K - 1) & 0xFFFFF000,
+					m->stack_lin_base + 1, 1);
+	free_PCB(t);
+	u_proc_sum -= 1;
+}
+
+/* p is dead without live threads, and unlinked from its parent. its dead
+ * threads, memory, page tables and PCB are all freed. p's cr3 isn't loaded,
+ * because the reaper is another process.
+ */
+PRIVATE void reap_proc(PROCESS *p)
+{
+	PROCESS *c, *next;
+
+	for (c = p->task.info.child_list; c != 0; c = next) {
+		next = c->task.info.sibling;
+		if (c->task.info.type == TYPE_THREAD) {
+			free_PCB(c);	//the stack is freed with p's memory
+			u_proc_sum -= 1;
+		} else {
+			c->task.info.ppid = -1;	//no init to adopt it
+		}
+	}
+	release_user_mem(p);
+	free_page_dir(p->task.cr3 & 0xFFFFF000);
+	free_PCB(p);
+	u_proc_sum -= 1;
+}
+
+/*======================================================================*
+                           sys_exit
+ *======================================================================*/
+//a thread exits alone, and its process keeps running
+PUBLIC void sys_exit(int status)
+{
+	disable_int();
+	exit_proc(p_proc_current, status);
+	sched();	//a ZOMBIE leaves the runqueue and never runs again
+}
+
+/* called in kernel.asm before going back to ring 1 or 3. a thread marked
+ * by kill_threads() has finished its syscall, and exits here.
+ */
+PUBLIC void exit_killed()
+{
+	if (p_proc_current->task.killed == 0)
+		return;
+	disable_int();
+	exit_proc(p_proc_current, -1);
+	sched();
+}
+
+/* called by exec before the memory of the current process is released.
+ * the other threads exit, and their PCBs are freed, for nobody can join
+ * them after exec.
+ */
+PUBLIC void exit_threads()
+{
+	PROCESS *p = p_proc_current;
+	PROCESS *c, *next;
+	u32 eflags;
+
+	if (p->task.info.type != TYPE_PROCESS)
+		return;
+	eflags = disable_int_save();
+	kill_threads(p);
+	while (live_threads(p))
+		sleep_on_channel(child_channel(p));
+	for (c = p->task.info.child_list; c != 0; c = next) {
+		next = c->task.info.sibling;
+		if (c->task.info.type != TYPE_THREAD)
+			continue;
+		del_child(p, c);
+		p->task.info.child_t_num--;
+		free_PCB(c);	//the stacks are freed with p's memory
+		u_proc_sum -= 1;
+	}
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           sys_wait
+ *======================================================================*/
+/* wait for a child process to exit, and free everything it owns. return
+ * its pid and store its exit status in *status if status isn't 0, or
+ * return -1 if there is no child process at all.
+ */
+PUBLIC int sys_wait(int *status)
+{
+	PROCESS *p = p_proc_current;
+	PROCESS *c, *dead;
+	int nr, pid;
+	u32 eflags = disable_int_save();
+
+	for (;;) {
+		dead = 0;
+		nr = 0;
+		for (c = p->task.info.child_list; c != 0; c = c->task.info.sibling) {
+			if (c->task.info.type != TYPE_PROCESS)
+				continue;
+			nr++;
+			if (proc_dead(c) && !live_threads(c)) {
+				dead = c;
+				break;
+			}
+		}
+		if (dead != 0 || nr == 0)
+			break;
+		sleep_on_channel(child_channel(p));
+	}
+	if (dead == 0) {
+		restore_int(eflags);
+		return -1;
+	}
+	del_child(p, dead);
+	p->task.info.child_p_num--;
+	restore_int(eflags);
+
+	pid = dead->task.pid;
+	if (status != 0)
+		*status = dead->task.exit_status;
+	reap_proc(dead);
+	return pid;
+}
+
+/*======================================================================*
+                           sys_pthread_join
+ *======================================================================*/
+/* wait for the thread tid of the current process to exit, store its exit
+ * status in *status if status isn't 0, and free its stack and PCB.
+ * return 0, or -1 if tid isn't a thread of this process or is joined by
+ * another thread.
+ */
+PUBLIC int sys_pthread_join(void *uesp)
+{
+	int tid = get_arg(uesp, 1);
+	int *status = (int*)get_arg(uesp, 2);
+	PROCESS *t = pid2proc(tid);
+	PROCESS *proc = p_proc_current;
+	u32 eflags;
+
+	if (proc->task.info.type == TYPE_THREAD)
+		proc = pid2proc(proc->task.info.ppid);
+	if (t == 0 || t == p_proc_current || proc == 0)
+		return -1;
+
+	eflags = disable_int_save();
+	for (;;) {
+		if (pid2proc(tid) != t || t->task.info.type != TYPE_THREAD ||
+			t->task.info.ppid != (int)proc->task.pid) {
+			restore_int(eflags);
+			return -1;
+		}
+		if (proc_dead(t))
+			break;
+		sleep_on_channel(child_channel(proc));
+	}
+	del_child(proc, t);
+	t->task.info.ppid = -1;		//the other joiners give up
+	proc->task.info.child_t_num--;
+	restore_int(eflags);
+
+	if (status != 0)
+		*status = t->task.exit_status;
+	reap_thread(t);
+	return 0;
+}
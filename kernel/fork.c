@@ -61,12 +61,50 @@ PUBLIC int sys_fork()
 		disp_color_str("]",0x72);
 		
 		//anything child need is prepared now, set its state to ready. added by xw, 17/12/11
-		p_child->task.stat = READY;
+		//and put it into runqueue
+		wakeup_proc(p_child);
 	}
 	return p_child->task.pid;	
 }
 
 
+/**********************************************************
+*		fork_share_range
+*把父进程[base, limit)中已映射的页写时复制地共享给子进程
+*************************************************************/
+/* both sides map the frame read-only with PG_COW, and the first write of
+ * either copies it, see cow_fault(). a page that isn't writable stays so.
+ */
+PRIVATE void fork_share_range(u32 ppid, u32 pid, u32 base, u32 limit)
+{
+	u32 addr_lin, phy, eflags;
+	u32 *pte;
+	u32 pde_phy = get_pde_phy_addr(ppid);
+	
+	for(addr_lin = base ; addr_lin < limit ; addr_lin+=num_4K )
+	{
+		if(0 == pte_exist(pde_phy, addr_lin))
+		{
+			addr_lin |= num_4M - num_4K;	//no page table, skip the whole 4M of a sparse heap
+			continue;
+		}
+		pte = (u32*)K_PHY2LIN(get_pte_phy_addr(ppid, addr_lin)) + get_pte_index(addr_lin);
+		if(!(*pte & PG_P))
+			continue;
+		
+		eflags = disable_int_save();	//the parent's threads may write it now
+		if(*pte & (PG_RWW | PG_COW))
+		{
+			*pte = (*pte & ~PG_RWW) | PG_COW;
+			invlpg(addr_lin);
+		}
+		phy = *pte & 0xFFFFF000;
+		lin_mapping_phy(addr_lin, phy, pid, PG_P | PG_USU | PG_RWW, (*pte & 0xFFF) | PG_P | PG_USU);
+		frame_get(phy);
+		restore_int(eflags);
+	}
+}
+
 /**********************************************************
 *		fork_mem_cpy			//add by visual 2016.5.24
 *复制父进程的一系列内存数据
@@ -74,8 +112,9 @@ PUBLIC int sys_fork()
 PRIVATE int fork_mem_cpy(u32 ppid,u32 pid)
 {
 	u32 addr_lin;
+	LIN_MEMMAP *m = &p_proc_current->task.memmap;
 	//复制代码，代码是共享的，直接将物理地址挂载在子进程的页表上
-	for(addr_lin = p_proc_current->task.memmap.text_lin_base ; addr_lin < p_proc_current->task.memmap.text_lin_limit ; addr_lin+=num_4K )
+	for(addr_lin = m->text_lin_base ; addr_lin < m->text_lin_limit ; addr_lin+=num_4K )
 	{
 		lin_mapping_phy(addr_lin,//线性地址
 						get_page_phy_addr(ppid,addr_lin),//物理地址，为MAX_UNSIGNED_INT时，由该函数自动分配物理内存
@@ -83,70 +122,12 @@ PRIVATE int fork_mem_cpy(u32 ppid,u32 pid)
 						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
 						PG_P  | PG_USU | PG_RWR);//页表属性，代码是只读的
 	}
-	//复制数据，数据不共享，子进程需要申请物理地址，并复制过来
-	for(addr_lin = p_proc_current->task.memmap.data_lin_base ; addr_lin < p_proc_current->task.memmap.data_lin_limit ; addr_lin+=num_4K )
-	{	
-		lin_mapping_phy(SharePageBase,0,ppid,PG_P  | PG_USU | PG_RWW,0);//使用前必须清除这个物理页映射
-		//disp_str("#");
-		lin_mapping_phy(SharePageBase,MAX_UNSIGNED_INT,ppid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);//利用父进程的共享页申请物理页
-		memcpy((void*)SharePageBase,(void*)(addr_lin&0xFFFFF000),num_4K);//将数据复制到物理页上,注意这个地方是强制一页一页复制的
-		lin_mapping_phy(addr_lin,//线性地址
-						get_page_phy_addr(ppid,SharePageBase),//物理地址，获取共享页的物理地址，填进子进程页表
-						pid,//要挂载的进程的pid，子进程的pid
-						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
-						PG_P  | PG_USU | PG_RWW);//页表属性，数据是可读写的		
-	}
-	//复制保留内存，保留内存不共享，子进程需要申请物理地址，并复制过来
-	for(addr_lin = p_proc_current->task.memmap.vpage_lin_base ; addr_lin < p_proc_current->task.memmap.vpage_lin_limit ; addr_lin+=num_4K )
-	{
-		lin_mapping_phy(SharePageBase,0,ppid,PG_P  | PG_USU | PG_RWW,0);//使用前必须清除这个物理页映射
-		lin_mapping_phy(SharePageBase,MAX_UNSIGNED_INT,ppid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);//利用父进程的共享页申请物理页
-		memcpy((void*)SharePageBase,(void*)(addr_lin&0xFFFFF000),num_4K);//将数据复制到物理页上,注意这个地方是强制一页一页复制的
-		lin_mapping_phy(addr_lin,//线性地址
-						get_page_phy_addr(ppid,SharePageBase),//物理地址，获取共享页的物理地址，填进子进程页表
-						pid,//要挂载的进程的pid，子进程的pid
-						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
-						PG_P  | PG_USU | PG_RWW);//页表属性，保留内存是可读写的		
-	}
-	
-	//复制堆，堆不共享，子进程需要申请物理地址，并复制过来
-	for(addr_lin = p_proc_current->task.memmap.heap_lin_base ; addr_lin < p_proc_current->task.memmap.heap_lin_limit ; addr_lin+=num_4K )
-	{
-		lin_mapping_phy(SharePageBase,0,ppid,PG_P  | PG_USU | PG_RWW,0);//使用前必须清除这个物理页映射
-		lin_mapping_phy(SharePageBase,MAX_UNSIGNED_INT,ppid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);//利用父进程的共享页申请物理页
-		memcpy((void*)SharePageBase,(void*)(addr_lin&0xFFFFF000),num_4K);//将数据复制到物理页上,注意这个地方是强制一页一页复制的
-		lin_mapping_phy(addr_lin,//线性地址
-						get_page_phy_addr(ppid,SharePageBase),//物理地址，获取共享页的物理地址，填进子进程页表
-						pid,//要挂载的进程的pid，子进程的pid
-						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
-						PG_P  | PG_USU | PG_RWW);//页表属性，堆是可读写的		
-	}	
-	
-	//复制栈，栈不共享，子进程需要申请物理地址，并复制过来(注意栈的复制方向)
-	for(addr_lin = p_proc_current->task.memmap.stack_lin_base ; addr_lin > p_proc_current->task.memmap.stack_lin_limit ; addr_lin-=num_4K )
-	{
-		lin_mapping_phy(SharePageBase,0,ppid,PG_P  | PG_USU | PG_RWW,0);//使用前必须清除这个物理页映射
-		lin_mapping_phy(SharePageBase,MAX_UNSIGNED_INT,ppid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);//利用父进程的共享页申请物理页
-		memcpy((void*)SharePageBase,(void*)(addr_lin&0xFFFFF000),num_4K);//将数据复制到物理页上,注意这个地方是强制一页一页复制的
-		lin_mapping_phy(addr_lin,//线性地址
-						get_page_phy_addr(ppid,SharePageBase),//物理地址，获取共享页的物理地址，填进子进程页表
-						pid,//要挂载的进程的pid，子进程的pid
-						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
-						PG_P  | PG_USU | PG_RWW);//页表属性，栈是可读写的		
-	}
-	
-	//复制参数区，参数区不共享，子进程需要申请物理地址，并复制过来
-	for(addr_lin = p_proc_current->task.memmap.arg_lin_base ; addr_lin < p_proc_current->task.memmap.arg_lin_limit ; addr_lin+=num_4K )
-	{
-		lin_mapping_phy(SharePageBase,0,ppid,PG_P  | PG_USU | PG_RWW,0);//使用前必须清除这个物理页映射
-		lin_mapping_phy(SharePageBase,MAX_UNSIGNED_INT,ppid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);//利用父进程的共享页申请物理页
-		memcpy((void*)SharePageBase,(void*)(addr_lin&0xFFFFF000),num_4K);//将数据复制到物理页上,注意这个地方是强制一页一页复制的
-		lin_mapping_phy(addr_lin,//线性地址
-						get_page_phy_addr(ppid,SharePageBase),//物理地址，获取共享页的物理地址，填进子进程页表
-						pid,//要挂载的进程的pid，子进程的pid
-						PG_P  | PG_USU | PG_RWW,//页目录属性，一般都为可读写
-						PG_P  | PG_USU | PG_RWW);//页表属性，参数区是可读写的		
-	}
+	//数据、保留内存、堆、栈和参数区不再逐页复制，而是写时复制地共享，谁先写谁复制
+	fork_share_range(ppid, pid, m->data_lin_base, m->data_lin_limit);
+	fork_share_range(ppid, pid, m->vpage_lin_base, m->vpage_lin_limit);
+	fork_share_range(ppid, pid, m->heap_lin_base, m->heap_lin_limit);
+	fork_share_range(ppid, pid, (m->stack_lin_limit + num_4K - 1) & 0xFFFFF000, m->stack_lin_base + 1);	//栈向下生长
+	fork_share_range(ppid, pid, m->arg_lin_base, m->arg_lin_limit);
 	return 0;		
 }
 
@@ -182,6 +163,7 @@ PRIVATE int fork_pcb_cpy(PROCESS* p_child)
 	//Added by xw, 18/4/21
 	esp_save_int = p_child->task.esp_save_int;
 	esp_save_context = p_child->task.esp_save_context;
+	fpu_sync(p_proc_current);	//the child gets the parent's FPU state too
 //	disp_str("<");
 //	disp_int((int)(p_child->task.esp_save_context));
 //	disp_str("> ");
@@ -190,6 +172,7 @@ PRIVATE int fork_pcb_cpy(PROCESS* p_child)
 	//READY when anything else is well prepared. if an interruption happens right here,
 	//an error will still occur.
 	p_child->task.stat = IDLE;
+	clear_proc_links(p_child);	//the links copied from the parent are not the child's
 	p_child->task.esp_save_int = esp_save_int;	//esp_save_int of child must be restored!!
 	p_child->task.esp_save_context = esp_save_context;	//same above
 //	p_child->task.esp_save_context = (char*)(p_child + 1) - P_STACKTOP - 4 * 6;	
@@ -221,7 +204,7 @@ PRIVATE int fork_update_info(PROCESS* p_child)
 	//p_proc_current->task.info.real_ppid;  //亲父进程，创建它的那个进程
 	//p_proc_current->task.info.ppid;		//当前父进程	
 	p_proc_current->task.info.child_p_num += 1; //子进程数量
-	p_proc_current->task.info.child_process[p_proc_current->task.info.child_p_num-1] = p_child->task.pid;//子进程列表
+	add_child(p_proc_current, p_child);			//子进程链表
 	//p_proc_current->task.info.child_t_num;	//子线程数量
 	//p_proc_current->task.info.child_thread[NR_CHILD_MAX];//子线程列表	
 	//p_proc_current->task.text_hold;			//是否拥有代码
@@ -235,6 +218,7 @@ PRIVATE int fork_update_info(PROCESS* p_child)
 	//p_child->task.info.child_process[NR_CHILD_MAX] = pid;//子进程列表
 	p_child->task.info.child_t_num = 0;	//子线程数量
 	//p_child->task.info.child_thread[NR_CHILD_MAX];//子线程列表	
+	p_child->task.info.child_list = 0;	//the list copied from the parent isn't the child's
 	p_child->task.info.text_hold = 0;			//是否拥有代码，子进程不拥有代码
 	p_child->task.info.data_hold = 1;			//是否拥有数据，子进程拥有数据
 	
@@ -0,0 +1,153 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               fpu.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Lazy switching of the x87/SSE state.
+  The state in the registers belongs to fpu_owner, and CR0.TS is set
+  whenever another process runs, so its first FPU or SSE instruction
+  traps to #NM. fpu_nm_handler() then saves the owner's state into its
+  PCB and loads the current process's. A process which never touches
+  the FPU doesn't pay anything at switches.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+#define MXCSR_DEFAULT	0x1F80	//all SIMD exceptions masked, round to nearest
+
+PRIVATE PROCESS *fpu_owner;		//the process whose state is in the registers, 0 if none
+PRIVATE int fpu_fxsr;			//1 to use fxsave/fxrstor, 0 for fnsave/frstor
+
+//fxsave needs a 16 bytes aligned area
+#define fpu_area(p)	((void*)(((u32)(p)->task.fpu_area + 15) & ~15))
+
+PRIVATE void clts()
+{
+	asm volatile ("clts");
+}
+
+PRIVATE void stts()
+{
+	u32 cr0;
+
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+//TS must be clear
+PRIVATE void fpu_save(PROCESS *p)
+{
+	if (fpu_fxsr)
+		asm volatile ("fxsave (%0)" : : "r"(fpu_area(p)) : "memory");
+	else
+		asm volatile ("fnsave (%0)\n\t"
+					  "fwait" : : "r"(fpu_area(p)) : "memory");
+}
+
+PRIVATE void fpu_restore(PROCESS *p)
+{
+	if (fpu_fxsr)
+		asm volatile ("fxrstor (%0)" : : "r"(fpu_area(p)) : "memory");
+	else
+		asm volatile ("frstor (%0)" : : "r"(fpu_area(p)) : "memory");
+}
+
+/*======================================================================*
+                               init_fpu
+ *======================================================================*/
+/* called by each cpu. x87 errors are reported by #MF, and SSE is enabled
+ * if the cpu has fxsave/fxrstor.
+ */
+PUBLIC void init_fpu()
+{
+	u32 features = cpuid_edx(1);
+	u32 cr0, cr4;
+
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+	cr0 &= ~CR0_EM;
+	cr0 |= CR0_MP | CR0_NE | CR0_TS;
+	asm volatile ("mov %0, %%cr0" : : "r"(cr0));
+
+	if ((features & CPUID_FXSR) && (features & CPUID_SSE)) {
+		asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+		cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+		asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+		fpu_fxsr = 1;
+	}
+}
+
+/*======================================================================*
+                            fpu_nm_handler
+ *======================================================================*/
+//called by copr_not_available in kernel.asm with interrupt disabled
+PUBLIC void fpu_nm_handler()
+{
+	PROCESS *p = p_proc_current;
+	u32 mxcsr = MXCSR_DEFAULT;
+
+	clts();
+	if (fpu_owner == p)
+		return;
+	if (fpu_owner != 0)
+		fpu_save(fpu_owner);
+
+	if (p->task.fpu_used) {
+		fpu_restore(p);
+	} else {
+		//the first time p uses the FPU, give it a clean state
+		asm volatile ("fninit");
+		if (fpu_fxsr)
+			asm volatile ("ldmxcsr %0" : : "m"(mxcsr));
+		p->task.fpu_used = 1;
+	}
+	fpu_owner = p;
+}
+
+/*======================================================================*
+                              fpu_switch
+ *======================================================================*/
+/* called by schedule() with interrupt disabled when prev gives the cpu to
+ * next. TS is clear only while fpu_owner runs.
+ */
+PUBLIC void fpu_switch(PROCESS *prev, PROCESS *next)
+{
+	if (prev == fpu_owner)
+		stts();
+	else if (next == fpu_owner)
+		clts();
+}
+
+/* write the state of p in the registers into its PCB, so that fork can
+ * copy it to the child.
+ */
+PUBLIC void fpu_sync(PROCESS *p)
+{
+	u32 eflags = disable_int_save();
+
+	if (fpu_owner == p) {
+		clts();
+		fpu_save(p);
+		if (p != p_proc_current)
+			stts();
+	}
+	restore_int(eflags);
+}
+
+/* p's FPU state is no longer needed, e.g. it has exec'd a new program or
+ * its PCB is freed. it starts with a clean state next time.
+ */
+PUBLIC void fpu_release(PROCESS *p)
+{
+	u32 eflags = disable_int_save();
+
+	if (fpu_owner == p) {
+		fpu_owner = 0;
+		stts();
+	}
+	p->task.fpu_used = 0;
+	restore_int(eflags);
+}
@@ -36,6 +36,11 @@ PRIVATE struct file_desc f_desc_table[NR_FILE_DESC];
 PRIVATE struct inode inode_table[NR_INODE];
 PRIVATE struct super_block super_block[NR_SUPER_BLOCK];
 
+/* locks */
+PRIVATE SPINLOCK desc_lock;		//free slots of f_desc_table
+PRIVATE MUTEX inode_lock;		//inode_table, held while an inode is being read in
+PRIVATE MUTEX map_lock;			//inode-map and sector-map on disk
+
 /* functions */
 PRIVATE void mkfs();
 PRIVATE void read_super_block(int dev);
@@ -81,6 +86,10 @@ PUBLIC void init_fs()
 	//allocate fs buffer. added by xw, 18/6/15
 	//fsbuf = (u8*)K_PHY2LIN(sys_kmalloc(FSBUF_SIZE)); //deleted by xw, 18/12/27
 
+	spin_lock_init(&desc_lock, "fs_desc");
+	mutex_init(&inode_lock, "fs_inode");
+	mutex_init(&map_lock, "fs_map");
+
 	int i;
 	for (i = 0; i < NR_FILE_DESC; i++)
 		memset(&f_desc_table[i], 0, sizeof(struct file_desc));
@@ -94,7 +103,7 @@ PUBLIC void init_fs()
 	read_super_block(ROOT_DEV);
 	sb = get_super_block(ROOT_DEV);
 	disp_str("Superblock Address:");
-	disp_int(sb);
+	disp_int((int)sb);
 	disp_str(" \n");
 	if(sb->magic != MAGIC_V1) {
 		mkfs();
@@ -425,12 +434,13 @@ PRIVATE int do_open(MESSAGE *fs_msg)
 	}
 
 	/* find a free slot in f_desc_table[] */
+	spin_lock(&desc_lock);
 	for (i = 0; i < NR_FILE_DESC; i++)
 		if (f_desc_table[i].fd_inode == 0) {
-			f_desc_table[i].fd_inode = -1;	//to decrease the chance of two process finding the same free slot
-											//a lock should be used here in the future. added by xw, 18/12/28 
+			f_desc_table[i].fd_inode = -1;	//taken, but not filled in yet
 			break;
 		}
+	spin_unlock(&desc_lock);
 	if (i >= NR_FILE_DESC) {
 		// panic("f_desc_table[] is full (PID:%d)", proc2pid(p_proc_current));
 		disp_str("f_desc_table[] is full (PID:");
@@ -548,6 +558,7 @@ PRIVATE struct inode * create_file(char * path, int flags)
 	if (strip_path(filename, path, &dir_inode) != 0)
 		return 0;
 
+	mutex_lock(&map_lock);
 	int inode_nr = alloc_imap_bit(dir_inode->i_dev);
 	/// zcr debug(output is 0x1,wrong! should be 0x5!)
 	disp_str("inode_nr: ");
@@ -555,6 +566,7 @@ PRIVATE struct inode * create_file(char * path, int flags)
 	disp_str("    ");
 
 	int free_sect_nr = alloc_smap_bit(dir_inode->i_dev, NR_DEFAULT_FILE_SECTS);
+	mutex_unlock(&map_lock);
 	/// zcr debug(output is 0x10E)
 	// disp_str("free_sect_nr: ");
 	// disp_int(free_sect_nr);
@@ -844,11 +856,13 @@ PRIVATE struct inode * get_inode(int dev, int num)
 
 	struct inode * p;
 	struct inode * q = 0;
+	mutex_lock(&inode_lock);
 	for (p = &inode_table[0]; p < &inode_table[NR_INODE]; p++) {
 		if (p->i_cnt) {	/* not a free slot */
 			if ((p->i_dev == dev) && (p->i_num == num)) {
 				/* this is the inode we want */
 				p->i_cnt++;
+				mutex_unlock(&inode_lock);
 				return p;
 			}
 		}
@@ -858,8 +872,11 @@ PRIVATE struct inode * get_inode(int dev, int num)
 		}
 	}
 
-	if (!q)
+	if (!q) {
 		disp_str("Panic: the inode table is full");
+		mutex_unlock(&inode_lock);
+		return 0;
+	}
 
 	q->i_dev = dev;
 	q->i_num = num;
@@ -877,6 +894,7 @@ PRIVATE struct inode * get_inode(int dev, int num)
 	q->i_size = pinode->i_size;
 	q->i_start_sect = pinode->i_start_sect;
 	q->i_nr_sects = pinode->i_nr_sects;
+	mutex_unlock(&inode_lock);
 	return q;
 }
 
@@ -888,11 +906,13 @@ PRIVATE struct inode * get_inode_sched(int dev, int num)
 
 	struct inode * p;
 	struct inode * q = 0;
+	mutex_lock(&inode_lock);
 	for (p = &inode_table[0]; p < &inode_table[NR_INODE]; p++) {
 		if (p->i_cnt) {	/* not a free slot */
 			if ((p->i_dev == dev) && (p->i_num == num)) {
 				/* this is the inode we want */
 				p->i_cnt++;
+				mutex_unlock(&inode_lock);
 				return p;
 			}
 		}
@@ -902,8 +922,11 @@ PRIVATE struct inode * get_inode_sched(int dev, int num)
 		}
 	}
 
-	if (!q)
+	if (!q) {
 		disp_str("Panic: the inode table is full");
+		mutex_unlock(&inode_lock);
+		return 0;
+	}
 
 	q->i_dev = dev;
 	q->i_num = num;
@@ -921,6 +944,7 @@ PRIVATE struct inode * get_inode_sched(int dev, int num)
 	q->i_size = pinode->i_size;
 	q->i_start_sect = pinode->i_start_sect;
 	q->i_nr_sects = pinode->i_nr_sects;
+	mutex_unlock(&inode_lock);
 	return q;
 }
 
@@ -937,7 +961,9 @@ PRIVATE struct inode * get_inode_sched(int dev, int num)
 PRIVATE void put_inode(struct inode * pinode)
 {
 	// assert(pinode->i_cnt > 0);
+	mutex_lock(&inode_lock);
 	pinode->i_cnt--;
+	mutex_unlock(&inode_lock);
 }
 
 /*****************************************************************************
@@ -1232,7 +1258,9 @@ PRIVATE int do_close(int fd)
 	// disp_int(fd);
 	put_inode(p_proc_current->task.filp[fd]->fd_inode);
 	// disp_str("hh2");
+	spin_lock(&desc_lock);
 	p_proc_current->task.filp[fd]->fd_inode = 0;
+	spin_unlock(&desc_lock);
 	p_proc_current->task.filp[fd] = 0;
 
 	return 0;
@@ -1534,6 +1562,7 @@ PRIVATE int do_unlink(MESSAGE *fs_msg)
 	// assert(byte_idx < SECTOR_SIZE);	/* we have only one i-map sector */
 	/* read sector 2 (skip bootsect and superblk): */
 	char fsbuf[SECTOR_SIZE];	//local array, to substitute global fsbuf. added by xw, 18/12/27
+	mutex_lock(&map_lock);
 	RD_SECT_SCHED(pin->i_dev, 2, fsbuf);		//modified by xw, 18/12/27
 	// assert(fsbuf[byte_idx % SECTOR_SIZE] & (1 << bit_idx));
 	fsbuf[byte_idx % SECTOR_SIZE] &= ~(1 << bit_idx);
@@ -1595,6 +1624,7 @@ PRIVATE int do_unlink(MESSAGE *fs_msg)
 	// assert((fsbuf[i] & mask) == mask);
 	fsbuf[i] &= (~0) << bits_left;
 	WR_SECT_SCHED(pin->i_dev, s, fsbuf);				//modified by xw, 18/12/27
+	mutex_unlock(&map_lock);
 
 	/***************************/
 	/* clear the i-node itself */
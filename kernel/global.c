@@ -27,14 +27,12 @@
  */
 PUBLIC	PROCESS			cpu_table[NR_CPUS];
 
-PUBLIC	PROCESS			proc_table[NR_PCBS];										//edit by visual 2016.4.5	
-
 //PUBLIC	char			task_stack[STACK_SIZE_TOTAL]; //delete  by viusal 2016.4.28
 
-PUBLIC	TASK	task_table[NR_TASKS] = {{TestA, STACK_SIZE_TASK, "TestA"},			//edit by visual 2016.4.5	
-										{TestB, STACK_SIZE_TASK, "TestB"},	
-										{TestC, STACK_SIZE_TASK, "TestC"},
-									    {hd_service, STACK_SIZE_TASK, "hd_service"}};	//added by xw, 18/8/27
+PUBLIC	TASK	task_table[NR_TASKS] = {{TestA, STACK_SIZE_TASK, "TestA", SCHED_NORMAL, 0},			//edit by visual 2016.4.5	
+										{TestB, STACK_SIZE_TASK, "TestB", SCHED_NORMAL, 0},	
+										{TestC, STACK_SIZE_TASK, "TestC", SCHED_NORMAL, 0},
+									    {hd_service, STACK_SIZE_TASK, "hd_service", SCHED_FIFO, NR_PRIOS - 1}};	//added by xw, 18/8/27
 
 
 PUBLIC	irq_handler		irq_table[NR_IRQ];
@@ -61,6 +59,20 @@ PUBLIC	system_call		sys_call_table[NR_SYS_CALL] = {	sys_get_ticks, 									//1s
 													    sys_read,			//added by xw, 18/6/18		//20th
 													    sys_write,			//added by xw, 18/6/18
 													    sys_lseek,			//added by xw, 18/6/18
-														sys_unlink			//added by xw, 18/6/19		//23th
+														sys_unlink,			//added by xw, 18/6/19		//23th
+														sys_hd_wait,		//used by hd_service
+														sys_sched_setscheduler,
+														sys_get_lock_stat,
+														sys_get_sched_hist,
+														sys_get_switch_stat,
+														sys_set_mm_batch,
+														sys_futex,
+														sys_exit,			//30th
+														sys_wait,
+														sys_pthread_join,
+														sys_get_task_stat,
+														sys_clock_gettime,
+														sys_get_slab_stat,
+														sys_sbrk
 														};
 
@@ -24,6 +24,9 @@
 
 //added by xw, 18/8/28
 PRIVATE HDQueue hdque;
+PRIVATE SPINLOCK hdque_lock;	//taken by hd_service in ring 1 too, so it can't be a mutex
+PRIVATE WAIT_QUEUE hd_service_wait;	//hd_service sleeps here when hdque is empty
+PRIVATE PROCESS *hd_service_proc;	//the only one allowed to sleep on hd_service_wait
 PRIVATE volatile int hd_int_waiting_flag;
 PRIVATE	u8 hd_status;
 PRIVATE	u8 hdbuf[SECTOR_SIZE * 2];
@@ -72,6 +75,8 @@ PUBLIC void init_hd()
 	
 	//init hd rdwt queue. added by xw, 18/8/27
 	init_hd_queue(&hdque);
+	spin_lock_init(&hdque_lock, "hdque");
+	init_wait_queue(&hd_service_wait);
 }
 
 /*****************************************************************************
@@ -184,15 +189,19 @@ PUBLIC void hd_service()
 {
 	RWInfo *rwinfo;
 	
+	hd_service_proc = p_proc_current;
 	while(1)
 	{
 		//the hd queue is not empty when out_hd_queue return 1.
 		while(out_hd_queue(&hdque, &rwinfo))
 		{
 			hd_rdwt_real(rwinfo);
-			rwinfo->proc->task.stat = READY;
+			wake_up(&rwinfo->wait);	//rwinfo is on the requester's stack, don't touch it after this
 		}
-		yield();
+		
+		//sleep until hd_rdwt_sched() puts a new request into hdque,
+		//instead of yielding the cpu again and again.
+		hd_wait();
 		
 		//disp_str("H ");
 		//milli_delay(100);
@@ -200,6 +209,22 @@ PUBLIC void hd_service()
 	
 }
 
+/* hd_service runs in ring 1 and can't call sched() itself, so it sleeps
+ * in this syscall until hd_rdwt_sched() puts a request into hdque.
+ * the stub is in ulib too, so the other callers return at once.
+ */
+PUBLIC void sys_hd_wait()
+{
+	u32 eflags;
+	
+	if (p_proc_current != hd_service_proc)
+		return;
+	eflags = disable_int_save();
+	if (hdque.front == NULL)
+		sleep_on(&hd_service_wait);
+	restore_int(eflags);
+}
+
 PRIVATE void hd_rdwt_real(RWInfo *p)
 {
 	int drive = DRV_OF_DEV(p->msg->DEVICE);
@@ -250,32 +275,31 @@ PRIVATE void hd_rdwt_real(RWInfo *p)
 PUBLIC void hd_rdwt_sched(MESSAGE *p)
 {
 	RWInfo rwinfo;
-	struct memfree hdque_buf;
 	int size = p->CNT;
 	void *buffer;
+	u32 eflags;
 	
-	buffer = (void*)K_PHY2LIN(sys_kmalloc(size));
+	buffer = kmem_alloc(size);	//from the kmalloc-N caches mostly, without memman
 	rwinfo.msg = p;
 	rwinfo.kbuf = buffer;
 	rwinfo.proc = p_proc_current;
+	init_wait_queue(&rwinfo.wait);
 	
-	if (p->type == DEV_READ) {
-		in_hd_queue(&hdque, &rwinfo);
-		p_proc_current->task.channel = &hdque;
-		p_proc_current->task.stat = SLEEPING;
-		sched();
-		phys_copy(p->BUF, buffer, p->CNT);
-	} else {
+	if (p->type == DEV_WRITE)
 		phys_copy(buffer, p->BUF, p->CNT);
-		in_hd_queue(&hdque, &rwinfo);
-		p_proc_current->task.channel = &hdque;
-		p_proc_current->task.stat = SLEEPING;
-		sched();
-	}
 	
-	hdque_buf.addr = K_LIN2PHY((u32)buffer);
-	hdque_buf.size = size;
-	sys_free(&hdque_buf);
+	//interrupt is disabled until the requester sleeps, so the request can't
+	//be finished before that, and the wakeup won't be lost.
+	eflags = disable_int_save();
+	in_hd_queue(&hdque, &rwinfo);
+	wake_up(&hd_service_wait);	//only hd_service sleeps there, see sys_hd_wait()
+	sleep_on(&rwinfo.wait);
+	restore_int(eflags);
+	
+	if (p->type == DEV_READ)
+		phys_copy(p->BUF, buffer, p->CNT);
+	
+	kmem_free(buffer, size);
 }
 
 PUBLIC void init_hd_queue(HDQueue *hdq)
@@ -286,18 +310,23 @@ PUBLIC void init_hd_queue(HDQueue *hdq)
 PRIVATE void in_hd_queue(HDQueue *hdq, RWInfo *p)
 {
 	p->next = NULL;
+	spin_lock(&hdque_lock);
 	if(hdq->rear == NULL) {	//put in the first node
 		hdq->front = hdq->rear = p;
 	} else {
 		hdq->rear->next = p;
 		hdq->rear = p;
 	}
+	spin_unlock(&hdque_lock);
 }
 
 PRIVATE int out_hd_queue(HDQueue *hdq, RWInfo **p)
 {
-	if (hdq->rear == NULL)
+	spin_lock(&hdque_lock);
+	if (hdq->rear == NULL) {
+		spin_unlock(&hdque_lock);
 		return 0;	//empty
+	}
 	
 	*p = hdq->front;
 	if (hdq->front == hdq->rear) {	//put out the last node
@@ -305,6 +334,7 @@ PRIVATE int out_hd_queue(HDQueue *hdq, RWInfo **p)
 	} else {
 		hdq->front = hdq->front->next;
 	}
+	spin_unlock(&hdque_lock);
 	return 1;	//not empty
 }
 //~xw
@@ -662,9 +692,10 @@ PRIVATE int waitfor(int mask, int val, int timeout)
 		if ((in_byte(REG_STATUS) & mask) == val)
 			return 1;
 	*/
-	int t = sys_get_ticks();
+	//ticks don't go on with interrupt disabled, the TSC clock does
+	u64 start = ktime_get_ns();
 	
-	while(((sys_get_ticks() - t) * 1000 / HZ) < timeout){
+	while(ktime_get_ns() - start < (u64)timeout * NSEC_PER_MSEC){
 		if ((in_byte(REG_STATUS) & mask) == val)
 			return 1;
 	}
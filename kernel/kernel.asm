@@ -19,9 +19,14 @@ extern	delay
 extern	irq_table
 extern	page_fault_handler
 extern	divide_error_handler	;added by xw, 18/12/22
+extern	fpu_nm_handler
 extern	disp_int
 extern  schedule
 extern  switch_pde
+extern	acct_kernel_enter
+extern	acct_kernel_exit
+extern	exit_killed
+extern	acct_syscall
 
 ; 导入全局变量
 extern	gdt_ptr
@@ -35,6 +40,7 @@ extern 	cr3_ready			;add by visual 2016.4.5
 extern  p_proc_current
 extern	p_proc_next			;added by xw, 18/4/26
 extern	kernel_initial		;added by xw, 18/6/10
+extern	cpus
 
 bits 32
 
@@ -60,10 +66,13 @@ global restart_restore	;Added by xw, 18/4/21
 ;global save_context
 global sched			;Added by xw, 18/4/21
 global sys_call
+global sysenter_entry
 global read_cr2   ;//add by visual 2016.5.9
 global refresh_page_cache ; // add by visual 2016.5.12
+global invlpg
 global halt  			;added by xw, 18/6/11
 global get_arg			;added by xw, 18/6/18
+global read_tsc
 
 global	divide_error
 global	single_step_exception
@@ -81,6 +90,7 @@ global	stack_exception
 global	general_protection
 global	page_fault
 global	copr_error
+global	simd_error
 global	hwint00
 global	hwint01
 global	hwint02
@@ -482,7 +492,19 @@ inval_opcode:					; vector_no	= 6
 	exception_no_errcode	6, exception_handler
 	
 copr_not_available:				; vector_no	= 7
-	exception_no_errcode	7, exception_handler
+;	exception_no_errcode	7, exception_handler
+;the FPU is used while CR0.TS is set, switch the FPU state lazily, see fpu.c
+	pushad
+	push	ds
+	push	es
+	mov		ax, SELECTOR_KERNEL_DS
+	mov		ds, ax
+	mov		es, ax
+	call	fpu_nm_handler
+	pop		es
+	pop		ds
+	popad
+	iretd
 	
 double_fault:					; vector_no	= 8
 	exception_errcode	8, exception_handler
@@ -507,6 +529,9 @@ page_fault:						; vector_no	= 14
 	
 copr_error:						; vector_no	= 16
 	exception_no_errcode	16, exception_handler
+	
+simd_error:						; vector_no	= 19
+	exception_no_errcode	19, exception_handler
 
 ;environment saving when an exception occurs
 ;added by xw, 18/12/18
@@ -586,6 +611,10 @@ save_int:
 		mov		fs, dx							;value of fs and gs in user process is different to that in kernel
 		mov		dx, SELECTOR_VIDEO - 2			;added by xw, 18/6/20
 		mov		gs, dx
+		test	dword [esp + CSREG - P_STACKBASE], 3	;interrupted in ring 1 or 3, charge user time
+		jz		.in_kernel
+		call	acct_kernel_enter
+.in_kernel:
 
         mov     esi, esp  		                                        
 	    mov     esp, StackTop   ;switches to the irq-stack from current process's kernel stack 
@@ -642,8 +671,11 @@ sched:
 		call	schedule			;schedule is a C function, save eax, ecx, edx if you want them to stay unchanged.
 ;prepare to run new process
 		mov		ebx,  [p_proc_next]	;added by xw, 18/4/26
+		cmp		ebx, [p_proc_current]
+		je		.restore_context	;the same process goes on, nothing to renew
 		mov		dword [p_proc_current], ebx
 		call	renew_env			;renew process executing environment
+.restore_context:
 ;restore_context
 		mov		ebx, [p_proc_current]
 		mov 	esp, [ebx + ESP_SAVE_CONTEXT]		;switch to a new kernel stack
@@ -661,8 +693,11 @@ sched:
 ;renew process executing environment. Added by xw, 18/4/19
 renew_env:
 		call	switch_pde		;to change the global variable cr3_ready
+		test	eax, eax		;0 if the page directory doesn't change
+		jz		.same_pde
 		mov 	eax,[cr3_ready]	;to switch the page directory table
 		mov 	cr3,eax
+.same_pde:
 
 		mov		eax, [p_proc_current]
 		lldt	[eax + P_LDT_SEL]				;load LDT
@@ -694,6 +729,9 @@ sys_call:
 ;syscall that's called gets its argument from pushed ebx
 ;so we can't modify eax and ebx in save_syscall
 	call	save_syscall	;save registers and some other things. modified by xw, 17/12/11
+	push	eax
+	call	acct_syscall	;count it and charge user time, keeps ebx
+	pop		eax
 	sti
 	push 	ebx							;push the argument the syscall need
 	call    [sys_call_table + eax * 4]	;将参数压入堆栈后再调用函数			add by visual 2016.4.6
@@ -704,6 +742,37 @@ sys_call:
 	mov     [esi + EAXREG - P_STACKBASE], eax	;the return value of C function is in EAX
 	ret
 
+; ====================================================================================
+;                                 sysenter_entry
+; ====================================================================================
+;用户进程在 do_syscall 中执行 sysenter 后来到这里, eax 是调用号, ebx 是参数,
+;ecx 和 edx 是返回用户态后的 esp 和 eip. cpu 已经关中断, 并从 MSR 装入了
+;cs, ss 和 esp, 但 esp 指向的是 tss.esp0 本身, 见 init_sysenter().
+;在内核栈上手工压入与 int 0x90 相同的栈帧, 所以 fork, exec 等修改栈帧的代码
+;以及之后用 iretd 返回都不受影响.
+sysenter_entry:
+	mov		esp, [esp]					;switch to the kernel stack of the current process
+	push	SELECTOR_USER_DS			;ss
+	push	ecx							;esp
+	pushfd
+	or		dword [esp], 0x200			;eflags, sysenter has cleared IF
+	push	SELECTOR_USER_CS			;cs
+	push	edx							;eip
+	call	save_syscall
+	add		esp, 4						;drop restart_syscall pushed by save_syscall
+	push	eax
+	call	acct_syscall
+	pop		eax
+	sti
+	push 	ebx
+	call    [sys_call_table + eax * 4]
+	add		esp, 4
+	cli
+	mov		edx, [p_proc_current]
+	mov 	esi, [edx + ESP_SAVE_SYSCALL]
+	mov     [esi + EAXREG - P_STACKBASE], eax
+	jmp		restart_sysenter
+
 ; ====================================================================================
 ;				    restart
 ; ====================================================================================
@@ -719,6 +788,8 @@ restart_int:
 	mov 	esp, [eax + ESP_SAVE_INT]		;switch back to the kernel stack from the irq-stack	
 	cmp	    dword [kernel_initial], 0		;added by xw, 18/6/10
 	jnz		restart_restore
+	cmp		dword [cpus + CPU_NEED_RESCHED], 0	;processes only run on cpus[0]
+	jz		restart_restore
 	call	sched							;save current process's context, invoke schedule(), and then
 											;switch to the chosen process's kernel stack and restore it's context
 											;added by xw, 18/4/19
@@ -730,12 +801,43 @@ restart_syscall:
 ;	mov		dword [eax + SAVE_TYPE], ebx	;clear 3rd-bit of save_type
 	mov		eax, [p_proc_current]
 	mov 	esp, [eax + ESP_SAVE_SYSCALL]	;xw	restore esp position
+	cmp		dword [cpus + CPU_NEED_RESCHED], 0	;no schedule() pass for trivial syscalls
+	jz		restart_restore
 	call	sched							;added by xw, 18/4/26
 	jmp 	restart_restore
 
+;like restart_syscall, but return by sysexit, which needs eip in edx and esp in ecx
+restart_sysenter:
+	mov		eax, [p_proc_current]
+	mov 	esp, [eax + ESP_SAVE_SYSCALL]
+	cmp		dword [cpus + CPU_NEED_RESCHED], 0
+	jz		.restore
+	call	sched
+.restore:
+	call	exit_killed						;a killed thread doesn't go back
+	call	acct_kernel_exit				;charge system time
+	pop		gs
+	pop		fs
+	pop		es
+	pop		ds
+	popad
+	add		esp, 4							;skip retaddr, now esp points to eip
+	mov		edx, [esp]						;eip
+	mov		ecx, [esp + 12]					;esp
+	push	dword [esp + 8]					;eflags
+	and		dword [esp], ~0x200				;keep IF clear until sysexit
+	popfd
+	sti										;interrupt is enabled after sysexit
+	sysexit
+
 ;xw	restart_reenter:
 restart_restore:
 ;	dec		dword [k_reenter]
+	test	dword [esp + CSREG - P_STACKBASE], 3	;back to ring 1 or 3, charge system time
+	jz		.to_kernel
+	call	exit_killed						;a killed thread doesn't go back
+	call	acct_kernel_exit
+.to_kernel:
 	pop		gs
 	pop		fs
 	pop		es
@@ -773,10 +875,28 @@ read_cr2:
 ; ====================================================================================
 ;				    refresh_page_cache		//add by visual 2016.5.12
 ; ====================================================================================	
+;global pages, i.e. the kernel mapping, stay in TLB
 refresh_page_cache:
 	mov eax,cr3
 	mov cr3,eax
 	ret
+
+; ====================================================================================
+;				    void invlpg(u32 AddrLin)
+; ====================================================================================
+;drop the TLB entry of only one page, even if it's global
+invlpg:
+	mov eax, [esp + 4]
+	invlpg [eax]
+	ret
+	
+; ====================================================================================
+;				    u64 read_tsc()
+; ====================================================================================	
+; the time stamp counter is returned in edx:eax, which is how gcc returns u64
+read_tsc:
+	rdtsc
+	ret
 	
 ; ====================================================================================
 ;				    halt					//added by xw, 18/6/11			
@@ -360,6 +360,58 @@ void initial()
  }
 //	*/
 
+/*======================================================================*
+                          Idle Task Test
+ *======================================================================*/
+/* all tasks sleep most of the time, so the idle task runs and the tick is
+ * stopped. TestC shows how many ticks are saved and the average wakeup
+ * latency in TSC cycles.
+ */
+	/*
+void TestA()
+{
+	while (1)
+	{
+		disp_str("A ");
+		sleep(50);
+	}
+}
+
+void TestB()
+{
+	while (1)
+	{
+		disp_str("B ");
+		sleep(70);
+	}
+}
+
+void TestC()
+{
+	while (1)
+	{
+		sleep(300);
+		disp_str("[idle:");
+		disp_int(idle_stat.idle_count);
+		disp_str(" skipped:");
+		disp_int(idle_stat.ticks_skipped);
+		disp_str(" latency:");
+		if (idle_stat.wakeups != 0)
+			disp_int((u32)idle_stat.wakeup_cycles / idle_stat.wakeups);
+		disp_str("] ");
+	}
+}
+
+void initial()
+ {
+	while (1)
+	{
+		disp_str("I ");
+		sleep(100);
+	}
+ }
+//	*/
+
 /*======================================================================*
                           User Process Test
 added by xw, 18/4/27
@@ -0,0 +1,219 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               lock.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Spinlocks, sleeping mutexes and semaphores.
+  A spinlock keeps interrupt disabled while it's held, so it can be used
+  by interrupt handlers and ring-1 tasks, but it mustn't be held across
+  a sleep. A mutex or a semaphore puts the taker to sleep on its wait
+  queue, so it can only be used in syscalls.
+  Every lock counts how often it is taken and contended and how long it
+  is waited for and held, in TSC cycles.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+PRIVATE LOCK_STAT *lock_stat_table[NR_LOCK_STATS];	//named locks, read by get_lock_stat()
+PRIVATE int nr_lock_stats;
+
+/*======================================================================*
+                            lock statistics
+ *======================================================================*/
+//a lock without name isn't listed, but it's counted all the same
+PRIVATE void lock_stat_init(LOCK_STAT *stat, char *name)
+{
+	u32 eflags;
+	int i;
+
+	memset(stat, 0, sizeof(LOCK_STAT));
+	if (name == 0)
+		return;
+	for (i = 0; i < LOCK_NAME_LEN - 1 && name[i] != 0; i++)
+		stat->name[i] = name[i];
+
+	eflags = disable_int_save();
+	if (nr_lock_stats < NR_LOCK_STATS)
+		lock_stat_table[nr_lock_stats++] = stat;
+	restore_int(eflags);
+}
+
+//wait_start is 0 if the lock is got at once
+PRIVATE void lock_acquired(LOCK_STAT *stat, u64 *acquire_tsc, u64 wait_start)
+{
+	u64 now = read_tsc();
+
+	stat->acquired++;
+	if (wait_start != 0) {
+		stat->contended++;
+		stat->wait_cycles += now - wait_start;
+	}
+	*acquire_tsc = now;
+}
+
+PRIVATE void lock_released(LOCK_STAT *stat, u64 acquire_tsc)
+{
+	u64 held = read_tsc() - acquire_tsc;
+
+	stat->hold_cycles += held;
+	if (held > stat->hold_max)
+		stat->hold_max = held;
+}
+
+/* copy the statistics of the idx-th named lock to buf.
+ * return 0, or -1 if there are no more locks or buf is invalid.
+ */
+PUBLIC int sys_get_lock_stat(void *uesp)
+{
+	int idx = get_arg(uesp, 1);
+	LOCK_STAT *buf = (LOCK_STAT*)get_arg(uesp, 2);
+	u32 eflags;
+
+	if (idx < 0 || idx >= nr_lock_stats || !user_buf_ok(buf, sizeof(LOCK_STAT)))
+		return -1;
+	eflags = disable_int_save();	//take a consistent snapshot
+	memcpy(buf, lock_stat_table[idx], sizeof(LOCK_STAT));
+	restore_int(eflags);
+	return 0;
+}
+
+/*======================================================================*
+                               spinlock
+ *======================================================================*/
+PRIVATE u32 xchg(volatile u32 *addr, u32 value)
+{
+	asm volatile ("xchgl %0, %1"
+				  : "+m"(*addr), "+r"(value)
+				  :
+				  : "memory");
+	return value;
+}
+
+PUBLIC void spin_lock_init(SPINLOCK *lock, char *name)
+{
+	lock->locked = 0;
+	lock_stat_init(&lock->stat, name);
+}
+
+/* interrupt is disabled until spin_unlock(), so the holder can't be
+ * preempted, and on one cpu the lock is never seen taken. nested
+ * spinlocks must be released in the reverse order.
+ */
+PUBLIC void spin_lock(SPINLOCK *lock)
+{
+	u32 eflags = disable_int_save();
+	u64 wait_start = 0;
+
+	while (xchg(&lock->locked, 1) != 0) {
+		if (wait_start == 0)
+			wait_start = read_tsc();
+		asm volatile ("pause");
+	}
+	lock->eflags = eflags;
+	lock_acquired(&lock->stat, &lock->acquire_tsc, wait_start);
+}
+
+PUBLIC void spin_unlock(SPINLOCK *lock)
+{
+	u32 eflags = lock->eflags;
+
+	lock_released(&lock->stat, lock->acquire_tsc);
+	xchg(&lock->locked, 0);
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                                mutex
+ *======================================================================*/
+PUBLIC void mutex_init(MUTEX *mutex, char *name)
+{
+	mutex->locked = 0;
+	mutex->owner = 0;
+	init_wait_queue(&mutex->wait);
+	lock_stat_init(&mutex->stat, name);
+}
+
+//sleep until the mutex is free. a mutex isn't recursive
+PUBLIC void mutex_lock(MUTEX *mutex)
+{
+	u32 eflags = disable_int_save();
+	u64 wait_start = 0;
+
+	while (mutex->locked) {
+		if (wait_start == 0)
+			wait_start = read_tsc();
+		sleep_on(&mutex->wait);
+	}
+	mutex->locked = 1;
+	mutex->owner = p_proc_current;
+	lock_acquired(&mutex->stat, &mutex->acquire_tsc, wait_start);
+	restore_int(eflags);
+}
+
+//return 1 if the mutex is got, or 0 without waiting
+PUBLIC int mutex_trylock(MUTEX *mutex)
+{
+	u32 eflags = disable_int_save();
+	int got = !mutex->locked;
+
+	if (got) {
+		mutex->locked = 1;
+		mutex->owner = p_proc_current;
+		lock_acquired(&mutex->stat, &mutex->acquire_tsc, 0);
+	}
+	restore_int(eflags);
+	return got;
+}
+
+/* the woken process takes the mutex only if nobody has got it before
+ * the woken one runs, otherwise it sleeps again.
+ */
+PUBLIC void mutex_unlock(MUTEX *mutex)
+{
+	u32 eflags = disable_int_save();
+
+	lock_released(&mutex->stat, mutex->acquire_tsc);
+	mutex->locked = 0;
+	mutex->owner = 0;
+	wake_up_one(&mutex->wait);
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                              semaphore
+ *======================================================================*/
+PUBLIC void sema_init(SEMAPHORE *sema, int count, char *name)
+{
+	sema->count = count;
+	init_wait_queue(&sema->wait);
+	lock_stat_init(&sema->stat, name);
+}
+
+PUBLIC void down(SEMAPHORE *sema)
+{
+	u32 eflags = disable_int_save();
+	u64 wait_start = 0;
+	u64 acquire_tsc;
+
+	while (sema->count <= 0) {
+		if (wait_start == 0)
+			wait_start = read_tsc();
+		sleep_on(&sema->wait);
+	}
+	sema->count--;
+	lock_acquired(&sema->stat, &acquire_tsc, wait_start);
+	restore_int(eflags);
+}
+
+PUBLIC void up(SEMAPHORE *sema)
+{
+	u32 eflags = disable_int_save();
+
+	sema->count++;
+	wake_up_one(&sema->wait);
+	restore_int(eflags);
+}
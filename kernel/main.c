@@ -39,6 +39,11 @@ PUBLIC int kernel_main()
 	kernel_initial = 1;	//kernel is in initial state. added by xw, 18/5/31
 	
 	init();//内存管理模块的初始化  add by liang 
+	kmem_init();	//object caches on top of memman, see slab.c
+	
+	enable_global_pages();	//the kernel PTEs made by init_page_pte() are global
+	enable_write_protect();	//kernel writes to fork-shared pages copy them too
+	init_fpu();				//FPU/SSE state is switched lazily, see fpu.c
 	
 	//initialize PCBs, added by xw, 18/5/26
 	error = initialize_processes();
@@ -53,12 +58,15 @@ PUBLIC int kernel_main()
 	k_reenter = 0;	//record nest level of only interruption! it's different from Orange's.
 					//usage modified by xw
 	ticks = 0;		//initialize system-wide ticks
+	init_timers();	//the timer wheel starts from ticks
 	p_proc_current = cpu_table;
 
 	/************************************************************************
 	*device initialization
 	added by xw, 18/6/4
 	*************************************************************************/
+    calibrate_tsc();		//before counter0 starts, the clock works without interrupts
+    
     /* initialize 8253 PIT */
     out_byte(TIMER_MODE, RATE_GENERATOR);
     out_byte(TIMER0, (u8) (TIMER_FREQ/HZ) );
@@ -100,7 +108,7 @@ PUBLIC int kernel_main()
 	 */
 	clear_kernel_pagepte_low();
 	
-	p_proc_current = proc_table;
+	p_proc_current = pid2proc(0);	//the first task
 	kernel_initial = 0;	//kernel initialization is done. added by xw, 18/5/31
 	restart_initial();	//modified by xw, 18/4/19
 	while(1){}
@@ -112,8 +120,45 @@ added by xw, 18/6/2
 ***************************************************************************/
 PRIVATE int initialize_cpus()
 {
-	//just use the fields of struct PCB in cpu_table, we needn't initialize
-	//something at present.
+	PROCESS*	p_proc		= cpu_table;
+	char* p_regs;
+	int cpu;
+	
+	/* the PCB in cpu_table is used as the idle task of each cpu. the idle task
+	 * runs in ring 0 with the selectors in GDT, so it needs no LDT, and it uses
+	 * the kernel page directory set up by loader. it's never put into runqueue,
+	 * schedule() chooses it only when there is no READY process.
+	 */
+	for( cpu=0 ; cpu<NR_CPUS ; cpu++ )
+	{
+		strcpy(p_proc->task.p_name, "idle");
+		p_proc->task.pid = NR_PIDS + cpu;	//not a real pid, pid2proc() doesn't know it
+		p_proc->task.stat = READY;
+		p_proc->task.ldt_sel = 0;
+		p_proc->task.cr3 = KernelPageTblAddr;
+		
+		p_proc->task.regs.cs	= SELECTOR_KERNEL_CS;
+		p_proc->task.regs.ds	= SELECTOR_KERNEL_DS;
+		p_proc->task.regs.es	= SELECTOR_KERNEL_DS;
+		p_proc->task.regs.fs	= SELECTOR_KERNEL_DS;
+		p_proc->task.regs.ss	= SELECTOR_KERNEL_DS;
+		p_proc->task.regs.gs	= SELECTOR_KERNEL_GS;
+		p_proc->task.regs.eflags = 0x0202; /* IF=1 */
+		p_proc->task.regs.eip	= (u32)cpu_idle;
+		
+		//iretd to ring 0 won't pop esp and ss, the idle task keeps
+		//running on its kernel stack.
+		p_regs = (char*)(p_proc + 1);
+		p_regs -= P_STACKTOP;
+		memcpy(p_regs, (char*)p_proc, 18 * 4);
+		
+		p_proc->task.esp_save_int = p_regs;
+		p_proc->task.esp_save_context = p_regs - 10 * 4;
+		*(u32*)(p_regs - 4) = (u32)restart_restore;
+		*(u32*)(p_regs - 8) = 0x0202;
+		
+		p_proc++;
+	}
 	
 	return 0;
 }
@@ -126,34 +171,36 @@ moved from kernel_main() by xw, 18/5/26
 PRIVATE int initialize_processes()
 {
 	TASK*		p_task		= task_table;
-	PROCESS*	p_proc		= proc_table;
-	u16		selector_ldt	= SELECTOR_LDT_FIRST;	
+	PROCESS*	p_proc;
 	char* p_regs;		//point to registers in the new kernel stack, added by xw, 17/12/11
 	task_f eip_context;	//a funtion pointer, added by xw, 18/4/18
 	/*************************************************************************
 	*进程初始化部分 	edit by visual 2016.5.4 
 	***************************************************************************/
-	int pid;
+	int i, pid;
 	u32 AddrLin,pte_addr_phy_temp,addr_phy_temp,err_temp;//edit by visual 2016.5.9
 	
-	/* set common fields in PCB. added by xw, 18/5/25 */
-	p_proc = proc_table;
-	for( pid=0 ; pid<NR_PCBS ; pid++ )
-	{
-		//some operations
-		p_proc++;
-	}
+	init_runqueue();
 	
-	p_proc = proc_table;	
-	for( pid=0 ; pid<NR_TASKS ; pid++ )
-	{//1>对前NR_TASKS个PCB初始化,且状态为READY(生成的进程)
+	/* PCBs are allocated by alloc_PCB() now, which also gives each of them a
+	 * pid and a LDT selector. PCBs for fork and pthread are allocated on demand,
+	 * so they need no initialization here.
+	 */
+	for( i=0 ; i<NR_TASKS ; i++ )
+	{//1>NR_TASKS个task的PCB初始化,且状态为READY(生成的进程)
+		p_proc = alloc_PCB();
+		if( p_proc == 0 )
+		{
+			disp_color_str("kernel_main Error:alloc_PCB",0x74);
+			return -1;
+		}
+		pid = p_proc->task.pid;
+		
 		/*************基本信息*********************************/
 		strcpy(p_proc->task.p_name, p_task->name);		//名称
-		p_proc->task.pid = pid;							//pid
 		p_proc->task.stat = READY;  						//状态
 		
 		/**************LDT*********************************/
-		p_proc->task.ldt_sel = selector_ldt;
 		memcpy(&p_proc->task.ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3],sizeof(DESCRIPTOR));
 		p_proc->task.ldts[0].attr1 = DA_C | PRIVILEGE_TASK << 5;
 		memcpy(&p_proc->task.ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3],sizeof(DESCRIPTOR));
@@ -231,67 +278,29 @@ PRIVATE int initialize_processes()
 														//start run. added by xw, 18/4/18
 		*(u32*)(p_regs - 8) = 0x1202;	//initialize EFLAGS in the context, IF=1, IOPL=1. xw, 18/4/20
 		
-		/***************变量调整****************************/
-		p_proc++;
-		p_task++;
-		selector_ldt += 1 << 3;
-	}
-	for( 	; pid<NR_K_PCBS ; pid++ )
-	{//2>对中NR_TASKS~NR_K_PCBS的PCB表初始化,状态为IDLE,没有初始化esp(并没有生成,所以没有代码入口,只是留位置)
-		/*************基本信息*********************************/
-		strcpy(p_proc->task.p_name, "Task");				//名称
-		p_proc->task.pid = pid;							//pid
-		p_proc->task.stat = IDLE;  						//状态
+		p_proc->task.ticks = p_proc->task.priority = 1;
+		p_proc->task.policy = p_task->policy;			//driver and service tasks may be real-time
+		p_proc->task.rt_priority = p_task->rt_priority;
+		enqueue_proc(p_proc);
 		
-		/**************LDT*********************************/
-		p_proc->task.ldt_sel = selector_ldt;
-		memcpy(&p_proc->task.ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3],sizeof(DESCRIPTOR));
-		p_proc->task.ldts[0].attr1 = DA_C | PRIVILEGE_TASK << 5;
-		memcpy(&p_proc->task.ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3],sizeof(DESCRIPTOR));
-		p_proc->task.ldts[1].attr1 = DA_DRW | PRIVILEGE_TASK << 5;
-		
-		/**************寄存器初值**********************************/
-		p_proc->task.regs.cs	= ((8 * 0) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_TASK;
-		p_proc->task.regs.ds	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_TASK;
-		p_proc->task.regs.es	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_TASK;
-		p_proc->task.regs.fs	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_TASK;
-		p_proc->task.regs.ss	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_TASK;
-		p_proc->task.regs.gs	= (SELECTOR_KERNEL_GS & SA_RPL_MASK)| RPL_TASK;
-		p_proc->task.regs.eflags = 0x1202; /* IF=1, IOPL=1 */		
-		
-		/****************页表、代码数据、堆栈*****************************/
-		//无
-		
-		/***************copy registers data to kernel stack****************************/
-		//copy registers data to the bottom of the new kernel stack
-		//added by xw, 17/12/11
-		p_regs = (char*)(p_proc + 1);
-		p_regs -= P_STACKTOP;
-		memcpy(p_regs, (char*)p_proc, 18 * 4);
-		
-		/***************some field about process switch****************************/
-		p_proc->task.esp_save_int = p_regs; //initialize esp_save_int, added by xw, 17/12/11
-		//p_proc->task.save_type = 1;
-		p_proc->task.esp_save_context = p_regs - 10 * 4; //when the process is chosen to run for the first time, 
-														//sched() will fetch value from esp_save_context
-		eip_context = restart_restore;
-		*(u32*)(p_regs - 4) = (u32)eip_context;			//initialize EIP in the context, so the process can
-														//start run. added by xw, 18/4/18
-		*(u32*)(p_regs - 8) = 0x1202;	//initialize EFLAGS in the context, IF=1, IOPL=1. xw, 18/4/20
-
 		/***************变量调整****************************/
-		p_proc++;
-		selector_ldt += 1 << 3;
+		p_task++;
 	}
-	for( ; pid<NR_K_PCBS+1 ; pid++ )
+	for( i=0 ; i<1 ; i++ )
 	{//initial 进程的初始化				//add by visual 2016.5.17
+		p_proc = alloc_PCB();
+		if( p_proc == 0 )
+		{
+			disp_color_str("kernel_main Error:alloc_PCB",0x74);
+			return -1;
+		}
+		pid = p_proc->task.pid;
+		
 		/*************基本信息*********************************/
 		strcpy(p_proc->task.p_name,"initial");			//名称
-		p_proc->task.pid = pid;							//pid
 		p_proc->task.stat = READY;  						//状态
 		
 		/**************LDT*********************************/
-		p_proc->task.ldt_sel = selector_ldt;
 		memcpy(&p_proc->task.ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3],sizeof(DESCRIPTOR));
 		p_proc->task.ldts[0].attr1 = DA_C | PRIVILEGE_TASK << 5;
 		memcpy(&p_proc->task.ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3],sizeof(DESCRIPTOR));
@@ -329,9 +338,9 @@ PRIVATE int initialize_processes()
 		p_proc->task.info.real_ppid = -1;  	//亲父进程，创建它的那个进程
 		p_proc->task.info.ppid = -1;			//当前父进程	
 		p_proc->task.info.child_p_num = 0;	//子进程数量
-		//p_proc->task.info.child_process[NR_CHILD_MAX];//子进程列表
 		p_proc->task.info.child_t_num = 0;		//子线程数量
-		//p_proc->task.info.child_thread[NR_CHILD_MAX];//子线程列表	
+		p_proc->task.info.child_list = 0;		//子进程和子线程链表
+		p_proc->task.info.sibling = 0;
 		p_proc->task.info.text_hold = 1;			//是否拥有代码
 		p_proc->task.info.data_hold = 1;			//是否拥有数据
 		
@@ -387,70 +396,16 @@ PRIVATE int initialize_processes()
 														//start run. added by xw, 18/4/18
 		*(u32*)(p_regs - 8) = 0x1202;	//initialize EFLAGS in the context, IF=1, IOPL=1. xw, 18/4/20
 		
-		/***************变量调整****************************/
-		p_proc++;
-		selector_ldt += 1 << 3;
+		p_proc->task.ticks = p_proc->task.priority = 1;
+		enqueue_proc(p_proc);
 	}
-	for( 	; pid<NR_PCBS ; pid++ )
-	{//3>对后NR_K_PCBS~NR_PCBS的PCB表部分初始化,(名称,pid,stat,LDT选择子),状态为IDLE.
-		/*************基本信息*********************************/
-		strcpy(p_proc->task.p_name, "USER");		//名称
-		p_proc->task.pid = pid;							//pid
-		p_proc->task.stat = IDLE;  						//状态
-		
-		/**************LDT*********************************/
-		p_proc->task.ldt_sel = selector_ldt;
-		memcpy(&p_proc->task.ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3],sizeof(DESCRIPTOR));
-		p_proc->task.ldts[0].attr1 = DA_C | PRIVILEGE_USER << 5;
-		memcpy(&p_proc->task.ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3],sizeof(DESCRIPTOR));
-		p_proc->task.ldts[1].attr1 = DA_DRW | PRIVILEGE_USER << 5;
-		
-		/**************寄存器初值**********************************/
-		p_proc->task.regs.cs	= ((8 * 0) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
-		p_proc->task.regs.ds	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
-		p_proc->task.regs.es	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
-		p_proc->task.regs.fs	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
-		p_proc->task.regs.ss	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
-		p_proc->task.regs.gs	= (SELECTOR_KERNEL_GS & SA_RPL_MASK)| RPL_USER;
-		p_proc->task.regs.eflags = 0x0202; /* IF=1, 倒数第二位恒为1 */
-		
-		/****************页表、代码数据、堆栈*****************************/
-		//无
-		
-		/***************copy registers data to kernel stack****************************/
-		//copy registers data to the bottom of the new kernel stack
-		//added by xw, 17/12/11
-		p_regs = (char*)(p_proc + 1);
-		p_regs -= P_STACKTOP;
-		memcpy(p_regs, (char*)p_proc, 18 * 4);
-		
-		/***************some field about process switch****************************/
-		p_proc->task.esp_save_int = p_regs; //initialize esp_save_int, added by xw, 17/12/11
-		//p_proc->task.save_type = 1;
-		p_proc->task.esp_save_context = p_regs - 10 * 4; //when the process is chosen to run for the first time, 
-														//sched() will fetch value from esp_save_context
-		eip_context = restart_restore;
-		*(u32*)(p_regs - 4) = (u32)eip_context;			//initialize EIP in the context, so the process can
-														//start run. added by xw, 18/4/18
-		*(u32*)(p_regs - 8) = 0x1202;	//initialize EFLAGS in the context, IF=1, IOPL=1. xw, 18/4/20
-		
-		/***************变量调整****************************/
-		p_proc++;
-		selector_ldt += 1 << 3;
-	}
-	
-	proc_table[0].task.ticks = proc_table[0].task.priority = 1;	
-	proc_table[1].task.ticks = proc_table[1].task.priority = 1;		
-	proc_table[2].task.ticks = proc_table[2].task.priority = 1;
-	proc_table[3].task.ticks = proc_table[3].task.priority = 1;	//added by xw, 18/8/27
-	proc_table[NR_K_PCBS].task.ticks = proc_table[NR_K_PCBS].task.priority = 1;
 	
 	/* When the first process begin running, a clock-interruption will happen immediately.
 	 * If the first process's initial ticks is 1, it won't be the first process to execute its
-	 * user code. Thus, it's will look weird, for proc_table[0] don't output first.
+	 * user code. Thus, it's will look weird, for the first task don't output first.
 	 * added by xw, 18/4/19
 	 */
-	proc_table[0].task.ticks = 2;
+	pid2proc(0)->task.ticks = 2;
 	
 	return 0;
 }
@@ -11,90 +11,27 @@ PUBLIC u32 memman_kalloc(struct MEMMAN *man,u32 size);
 PUBLIC u32 memman_alloc_4k(struct MEMMAN *man);
 PUBLIC u32 memman_kalloc_4k(struct MEMMAN *man);
 PUBLIC u32 memman_free(struct MEMMAN *man, u32 addr, u32 size);
+PUBLIC void memman_free_range(struct MEMMAN *man, u32 addr, u32 size);
 PUBLIC void disp_free();
 u32 memman_total(struct MEMMAN *man);
 
 void init()	//初始化
 {
 	u32 memstart = MEMSTART;			//4M 开始初始化
-	u32 i,j;
+	u32 i;
 	
 	memcpy(MemInfo,(u32 *)FMIBuff,1024);		//复制内存
 	
-	memman_init(memman);				//初始化memman中frees,maxfrees,lostsize,losts
+	memman_init(memman);				//初始化各zone的伙伴系统
 	
 	for(i = 1; i <= MemInfo[0]; i++)
 	{
 		if(MemInfo[i] < memstart)continue;	//4M 之后开始free
-		memman_free(memman,memstart,MemInfo[i] - memstart);	//free每一段可用内存
+		memman_free_range(memman,memstart,MemInfo[i] - memstart);	//free每一段可用内存
 		memstart = MemInfo[i] + 0x1000;	//memtest_sub(start,end)中每4KB检测一次
 	}
-	
-	for(i = 0; i < memman->frees; i++)
-	{//6M处分开，4～6M为kmalloc_4k使用，6～8M为kmalloc使用
-		if((memman->free[i].addr <= KWALL)&&(memman->free[i].addr + memman->free[i].size > KWALL)){
-			if(memman->free[i].addr == KWALL)break;
-			else{
-				
-				for(j = memman->frees; j>i+1; j--)
-				{	//i之后向后一位
-					memman->free[j] = memman->free[j-1];
-				}
-				memman->frees++;
-				if(memman->maxfrees < memman->frees){	//更新man->maxfrees
-					memman->maxfrees = memman->frees;
-				}
-				memman->free[i+1].addr = KWALL;	
-				memman->free[i+1].size = memman->free[i].addr + memman->free[i].size - KWALL;
-				memman->free[i].size = KWALL - 0x1000 - memman->free[i].addr;
-				break;
-			}
-		}
-	}
-	for(i = 0; i < memman->frees; i++)
-	{//8M处分开，4～8M为kmalloc使用，8～32M为malloc使用
-		if((memman->free[i].addr <= WALL)&&(memman->free[i].addr + memman->free[i].size > WALL)){
-			if(memman->free[i].addr == WALL)break;
-			else{
-				
-				for(j = memman->frees; j>i+1; j--)
-				{	//i之后向后一位
-					memman->free[j] = memman->free[j-1];
-				}
-				memman->frees++;
-				if(memman->maxfrees < memman->frees){	//更新man->maxfrees
-					memman->maxfrees = memman->frees;
-				}
-				memman->free[i+1].addr = WALL;	
-				memman->free[i+1].size = memman->free[i].addr + memman->free[i].size - WALL;
-				memman->free[i].size = WALL - 0x1000 - memman->free[i].addr;
-				break;
-			}
-		}
-	}
-
-	for(i = 0; i < memman->frees; i++)
-	{//16M处分开，8～16M为malloc使用，16～32M为malloc_4k使用
-		if((memman->free[i].addr <= UWALL)&&(memman->free[i].addr + memman->free[i].size > UWALL)){
-			if(memman->free[i].addr == UWALL)break;
-			else{
-				
-				for(j = memman->frees; j>i+1; j--)
-				{	//i之后向后一位
-					memman->free[j] = memman->free[j-1];
-				}
-				memman->frees++;
-				if(memman->maxfrees < memman->frees){	//更新man->maxfrees
-					memman->maxfrees = memman->frees;
-				}
-				memman->free[i+1].addr = UWALL;	
-				memman->free[i+1].size = memman->free[i].addr + memman->free[i].size - UWALL;
-				memman->free[i].size = UWALL - 0x1000 - memman->free[i].addr;
-				break;
-			}
-		}
-	}
-	
+	//4～6M为kmalloc_4k使用，6～8M为kmalloc使用，8～16M为malloc使用，16～32M为malloc_4k使用
+	//the zones are split at the walls in memman_init()
 	
 	//modified by xw, 18/6/18
 	// disp_str("**********");
@@ -110,172 +47,257 @@ void init()	//初始化
 
 void memman_init(struct MEMMAN *man)
 {	//memman基本信息初始化
-	man->frees = 0;
-	man->maxfrees = 0;
+	u32 walls[NR_ZONES + 1] = {MEMSTART, KWALL, WALL, UWALL, MEMEND};
+	u32 i,o;
+	
+	spin_lock_init(&man->lock, "memman");
 	man->lostsize = 0;
 	man->losts = 0;
+	for(i = 0; i < NR_ZONES; i++)
+	{
+		man->zone[i].base = (walls[i] - MEMSTART) >> 12;
+		man->zone[i].limit = (walls[i+1] - MEMSTART) >> 12;
+		man->zone[i].free_frames = 0;
+		for(o = 0; o <= BUDDY_MAX_ORDER; o++)
+			man->zone[i].free[o] = FRAME_NONE;
+	}
+	for(i = 0; i < NR_FRAMES; i++)
+	{
+		man->frame[i].order = 0;	//in use until freed
+		man->frame[i].refs = 0;
+	}
 	return;
 }
 
-PUBLIC u32 memman_alloc(struct MEMMAN *man,u32 size)
-{	//分配
-	u32 i,a;
-	for(i=0; i<man->frees; i++)
-	{
-		if((man->free[i].addr >= WALL)&&(man->free[i].addr + size < UWALL)){	//8M到16M
-			if(man->free[i].size >= size){
-				a = man->free[i].addr;
-				man->free[i].addr += size;
-				man->free[i].size -= size;
-				if(man->free[i].size == 0){
-					man->frees--;
-					for(; i<man->frees; i++)
-					{
-						man->free[i] = man->free[i+1];
-					}
-				}
-				return a;
-			}
-		}
-	}
-	return -1;
+/*======================================================================*
+                              buddy pools
+ *======================================================================*/
+/* a block of 2^order frames is free if its first frame has FRAME_FREE, and
+ * it's linked in zone->free[order]. blocks are aligned to their size from
+ * the base of the zone, so the buddy of a block is found by flipping one
+ * bit of its frame number in the zone.
+ * page faults and reapers allocate and free frames with interrupt enabled,
+ * so the free lists and refs are only changed with man->lock held.
+ */
+PRIVATE void free_list_add(struct MEMMAN *man, struct ZONE *z, u32 idx, u32 order)
+{
+	struct FRAME *f = &man->frame[idx];
+	
+	f->order = order | FRAME_FREE;
+	f->prev = FRAME_NONE;
+	f->next = z->free[order];
+	if(f->next != FRAME_NONE)
+		man->frame[f->next].prev = idx;
+	z->free[order] = idx;
 }
 
-PUBLIC u32 memman_kalloc(struct MEMMAN *man,u32 size)
-{	//分配
-	u32 i,a;
-	for(i=0; i<man->frees; i++)
-	{
-		if((man->free[i].addr >= KWALL)&&(man->free[i].addr + size < WALL)){	//4M到8M
-			if(man->free[i].size >= size){
-				a = man->free[i].addr;
-				man->free[i].addr += size;
-				man->free[i].size -= size;
-				if(man->free[i].size == 0){
-					man->frees--;
-					for(; i<man->frees; i++)
-					{
-						man->free[i] = man->free[i+1];
-					}
-				}
-				return a;
-			}
-		}
-		
-	}
-	return -1;
+PRIVATE void free_list_del(struct MEMMAN *man, struct ZONE *z, u32 idx, u32 order)
+{
+	struct FRAME *f = &man->frame[idx];
+	
+	if(f->prev != FRAME_NONE)
+		man->frame[f->prev].next = f->next;
+	else
+		z->free[order] = f->next;
+	if(f->next != FRAME_NONE)
+		man->frame[f->next].prev = f->prev;
+	f->order = order;
 }
 
-PUBLIC u32 memman_alloc_4k(struct MEMMAN *man)
-{	//分配
-	u32 i,a;
-	u32 size = 0x1000;
-	for(i=0; i<man->frees; i++)
+//the zone frame idx is in, or 0 if none
+PRIVATE struct ZONE* frame_zone(struct MEMMAN *man, u32 idx)
+{
+	u32 i;
+	
+	for(i = 0; i < NR_ZONES; i++)
 	{
-		if((man->free[i].addr >= UWALL)&&(man->free[i].addr + size < MEMEND)){	//16M到32M
-			if(man->free[i].size >= size){
-				a = man->free[i].addr;
-				man->free[i].addr += size;
-				man->free[i].size -= size;
-				if(man->free[i].size == 0){
-					man->frees--;
-					for(; i<man->frees; i++)
-					{
-						man->free[i] = man->free[i+1];
-					}
-				}
-				return a;
-			}
-		}
+		if(idx >= man->zone[i].base && idx < man->zone[i].limit)
+			return &man->zone[i];
 	}
-	return -1;
+	return 0;
 }
 
-PUBLIC u32 memman_kalloc_4k(struct MEMMAN *man)
-{	//分配
-	u32 i,a;
-	u32 size = 0x1000;
-	for(i=0; i<man->frees; i++)
+//the smallest order whose block holds size bytes
+PRIVATE u32 size_order(u32 size)
+{
+	u32 frames = (size + 0xFFF) >> 12;
+	u32 order = 0;
+	
+	while((1 << order) < frames)
+		order++;
+	return order;
+}
+
+/* take the smallest free block of at least 2^order frames, and give back
+ * the halves it's bigger by. return its physical address or -1.
+ */
+PRIVATE u32 buddy_alloc(struct MEMMAN *man, struct ZONE *z, u32 order)
+{
+	u32 o,idx;
+	
+	if(order > BUDDY_MAX_ORDER)
+		return -1;
+	spin_lock(&man->lock);
+	for(o = order; o <= BUDDY_MAX_ORDER; o++)
 	{
-		if((man->free[i].addr >= MEMSTART)&&(man->free[i].addr + size < KWALL)){	//4M到6M
-			if(man->free[i].size >= size){
-				a = man->free[i].addr;
-				man->free[i].addr += size;
-				man->free[i].size -= size;
-				if(man->free[i].size == 0){
-					man->frees--;
-					for(; i<man->frees; i++)
-					{
-						man->free[i] = man->free[i+1];
-					}
-				}
-				return a;
-			}
-		}
+		if(z->free[o] != FRAME_NONE)
+			break;
+	}
+	if(o > BUDDY_MAX_ORDER)
+	{
+		spin_unlock(&man->lock);
+		return -1;
+	}
+	
+	idx = z->free[o];
+	free_list_del(man, z, idx, o);
+	while(o > order)
+	{
+		o--;
+		free_list_add(man, z, idx + (1 << o), o);	//the upper half
 	}
-	return -1;
+	z->free_frames -= 1 << order;
+	spin_unlock(&man->lock);
+	return MEMSTART + (idx << 12);
 }
 
-PUBLIC u32 memman_free(struct MEMMAN *man, u32 addr, u32 size)
-{	//释放
-	int i,j;
-	
-	if(size == 0)return 0;	//初始化时，防止有连续坏块
+//merge the block with its free buddies as far as possible. man->lock must be held
+PRIVATE void buddy_free(struct MEMMAN *man, struct ZONE *z, u32 idx, u32 order)
+{
+	u32 rel = idx - z->base;
+	u32 buddy;
 	
-	for(i=0; i<man->frees; i++)
+	z->free_frames += 1 << order;
+	while(order < BUDDY_MAX_ORDER)
 	{
-		if(man->free[i].addr > addr){
+		buddy = z->base + (rel ^ (1 << order));
+		if(buddy >= z->limit || man->frame[buddy].order != (order | FRAME_FREE))
 			break;
-		}
-	}	//man->free[i-1].addr < addr <man->free[i].addr
-	
-	if(i > 0){	//前面有可分配内存
-		if(man->free[i-1].addr + man->free[i-1].size == addr){	//与前面相邻
-			man->free[i-1].size += size;
-			if(i < man->frees){	//后面有可分配内存
-				if(addr + size == man->free[i].addr){	//同时与后面相邻
-					man->free[i-1].size += man->free[i].size;
-					man->frees--;
-					for(; i<man->frees; i++)
-					{
-						man->free[i] = man->free[i+1];	//结构体赋值，i之后向前一位
-					}
-				}
-			}
-			return 0;
-		}	//与前面不相邻
-	}	//前面无可分配内存
+		free_list_del(man, z, buddy, order);
+		rel &= ~(1 << order);
+		order++;
+	}
+	free_list_add(man, z, z->base + rel, order);
+}
+
+/* free any page-aligned range, as the biggest aligned blocks it holds.
+ * frames out of the zones are left alone.
+ */
+PUBLIC void memman_free_range(struct MEMMAN *man, u32 addr, u32 size)
+{
+	u32 idx,end,order;
+	struct ZONE *z;
 	
-	if(i < man->frees){	//后面有可分配内存
-		if(addr + size == man->free[i].addr){	//与后面相邻
-			man->free[i].addr = addr;
-			man->free[i].size += size;
-			return 0;
-		}	
+	if(addr < MEMSTART)
+		return;
+	idx = (addr - MEMSTART) >> 12;
+	end = (addr + size - MEMSTART) >> 12;
+	spin_lock(&man->lock);
+	while(idx < end)
+	{
+		z = frame_zone(man, idx);
+		if(z == 0)
+			break;		//above MEMEND
+		order = 0;
+		while(order < BUDDY_MAX_ORDER && ((idx - z->base) & (1 << order)) == 0 &&
+			  idx + (2 << order) <= end && idx + (2 << order) <= z->limit)
+			order++;
+		buddy_free(man, z, idx, order);
+		idx += 1 << order;
 	}
+	spin_unlock(&man->lock);
+}
+
+/*======================================================================*
+                           memman interface
+ *======================================================================*/
+PUBLIC u32 memman_alloc(struct MEMMAN *man,u32 size)
+{	//分配, 8M到16M
+	return buddy_alloc(man, &man->zone[ZONE_USER], size_order(size));
+}
+
+PUBLIC u32 memman_kalloc(struct MEMMAN *man,u32 size)
+{	//分配, 6M到8M
+	return buddy_alloc(man, &man->zone[ZONE_KERNEL], size_order(size));
+}
+
+PUBLIC u32 memman_alloc_4k(struct MEMMAN *man)
+{	//分配, 16M到32M
+	return buddy_alloc(man, &man->zone[ZONE_UPAGE], 0);
+}
+
+PUBLIC u32 memman_kalloc_4k(struct MEMMAN *man)
+{	//分配, 4M到6M
+	return buddy_alloc(man, &man->zone[ZONE_KPAGE], 0);
+}
+
+//check the block and free it, man->lock must be held
+PRIVATE u32 block_free(struct MEMMAN *man, u32 addr, u32 size)
+{
+	u32 idx,order;
+	struct ZONE *z;
 	
-	if(man->frees < MEMMAN_FREES){	//数组未满
-		for(j = man->frees; j>i; j--)
-		{	//i之后向后一位
-			man->free[j] = man->free[j-1];
-		}
-		man->frees++;
-		if(man->maxfrees < man->frees){	//更新man->maxfrees
-			man->maxfrees = man->frees;
-		}
-		man->free[i].addr = addr;	//插入
-		man->free[i].size = size;
-		return 0;
+	idx = (addr - MEMSTART) >> 12;
+	order = size_order(size);
+	z = (addr >= MEMSTART && (addr & 0xFFF) == 0) ? frame_zone(man, idx) : 0;
+	if(z == 0 || ((idx - z->base) & ((1 << order) - 1)) != 0 ||
+	   idx + (1 << order) > z->limit || (man->frame[idx].order & FRAME_FREE)){
+		man->losts++;	//free失败
+		man->lostsize += size;
+		return -1;
 	}
+	buddy_free(man, z, idx, order);
+	return 0;
+}
+
+/* size must be the one the block is allocated with, so that it has the
+ * same order.
+ */
+PUBLIC u32 memman_free(struct MEMMAN *man, u32 addr, u32 size)
+{	//释放
+	u32 ret;
+	
+	if(size == 0)return 0;
 	
-	man->losts++;	//free失败
-	man->lostsize += size;
-	return -1;
+	spin_lock(&man->lock);
+	ret = block_free(man, addr, size);
+	spin_unlock(&man->lock);
+	return ret;
 }
 
+/* a frame shared by fork only loses a reference, the last one frees it.
+ * see frame_get().
+ */
 PUBLIC u32 memman_free_4k(struct MEMMAN *man, u32 addr)
 {
-	return memman_free(man, addr, 0x1000);
+	u32 idx = (addr - MEMSTART) >> 12;
+	u32 ret = 0;
+	
+	spin_lock(&man->lock);
+	if(addr >= MEMSTART && idx < NR_FRAMES && man->frame[idx].refs != 0)
+		man->frame[idx].refs--;
+	else
+		ret = block_free(man, addr, 0x1000);
+	spin_unlock(&man->lock);
+	return ret;
+}
+
+/*======================================================================*
+                        frame reference count
+ *======================================================================*/
+/* a user frame mapped by n processes has refs n-1, so a frame with refs 0
+ * belongs to one process only, as every frame memman hands out does.
+ */
+PUBLIC void frame_get(u32 addr)
+{
+	spin_lock(&memman->lock);
+	memman->frame[(addr - MEMSTART) >> 12].refs++;
+	spin_unlock(&memman->lock);
+}
+
+PUBLIC u32 frame_refs(u32 addr)
+{
+	return memman->frame[(addr - MEMSTART) >> 12].refs;
 }
 
 
@@ -311,13 +333,20 @@ PUBLIC u32 test_free_4k(u32 addr)
 }
 
 PUBLIC void disp_free()
-{	//打印空闲内存块信息
-	int i;
-	for(i = 0; i < memman->frees; i++)
+{	//打印空闲内存块信息, zone的空闲页数和各order的空闲块数
+	int i,o,n;
+	u32 idx;
+	for(i = 0; i < NR_ZONES; i++)
 	{
-		disp_int(memman->free[i].addr);
-		disp_str("#");
-		disp_int(memman->free[i].size);
+		disp_int(memman->zone[i].free_frames);
+		for(o = 0; o <= BUDDY_MAX_ORDER; o++)
+		{
+			n = 0;
+			for(idx = memman->zone[i].free[o]; idx != FRAME_NONE; idx = memman->frame[idx].next)
+				n++;
+			disp_str("#");
+			disp_int(n);
+		}
 		disp_str("###");
 	}
 }
@@ -325,8 +354,8 @@ PUBLIC void disp_free()
 u32 memman_total(struct MEMMAN *man)
 {	//free总容量
 	u32 i,t=0;
-	for(i=0; i<man->frees; i++){
-		t += man->free[i].size;
+	for(i=0; i<NR_ZONES; i++){
+		t += man->zone[i].free_frames << 12;
 	}
 	return t;
 }
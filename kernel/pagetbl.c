@@ -19,9 +19,66 @@ u32 cr2_count = 0;
                            switch_pde			added by xw, 17/12/11
  *switch the page directory table after schedule() is called
  *======================================================================*/
-PUBLIC	void switch_pde()
+//return 0 if cr3 already holds the page directory, e.g. the new process is
+//a thread sharing it with the old one, so renew_env needn't flush the TLB.
+PUBLIC	int switch_pde()
 {
+	u32 cr3;
+	
 	cr3_ready = p_proc_current->task.cr3;
+	switch_stat.switches++;
+	asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+	if (cr3 == cr3_ready) {
+		switch_stat.cr3_skipped++;
+		return 0;
+	}
+	return 1;
+}
+
+//copy the process switch statistics to buf, return 0 or -1 if buf is invalid
+PUBLIC	int sys_get_switch_stat(SWITCH_STAT *buf)
+{
+	u32 eflags;
+	
+	if (!user_buf_ok(buf, sizeof(SWITCH_STAT)))
+		return -1;
+	eflags = disable_int_save();
+	memcpy(buf, &switch_stat, sizeof(SWITCH_STAT));
+	restore_int(eflags);
+	return 0;
+}
+
+/*======================================================================*
+                           enable_global_pages
+ *======================================================================*/
+/* the kernel mapping above 3G is the same in every page directory, so
+ * init_page_pte() marks its PTEs PG_G, and they survive the cr3 reload of
+ * a process switch. called by each cpu.
+ */
+PUBLIC	void enable_global_pages()
+{
+	u32 cr4;
+	
+	if ((cpuid_edx(1) & CPUID_PGE) == 0)
+		return;
+	asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= CR4_PGE;
+	asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+}
+
+/*======================================================================*
+                          enable_write_protect
+ *======================================================================*/
+/* read-only user pages are read-only for the kernel too, so a syscall
+ * writing to a page shared by fork faults and copies it like the user
+ * does. called by each cpu.
+ */
+PUBLIC	void enable_write_protect()
+{
+	u32 cr0;
+	
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_WP));
 }
 
 /*======================================================================*
@@ -32,17 +89,18 @@ PUBLIC	u32 init_page_pte(u32 pid)
 {//页表初始化函数
 	
 	u32 AddrLin,pde_addr_phy_temp,pte_addr_phy_temp,err_temp;
+	void *pde_addr_lin;
 	
-	pde_addr_phy_temp = test_kmalloc_4k();//为页目录申请一页
-	memset((void*)K_PHY2LIN(pde_addr_phy_temp),0,num_4K);   //add by visual 2016.5.26
-	
-	if( pde_addr_phy_temp<0 || (pde_addr_phy_temp&0x3FF)!=0 ) 	//add by visual 2016.5.9
+	pde_addr_lin = kmem_cache_alloc(&pgtable_cache);//为页目录申请一页
+	if( pde_addr_lin==0 )
 	{	
 		disp_color_str("init_page_pte Error:pde_addr_phy_temp",0x74);
 		return -1;
 	}
+	pde_addr_phy_temp = K_LIN2PHY((u32)pde_addr_lin);
+	memset(pde_addr_lin,0,num_4K);   //add by visual 2016.5.26
 
-	proc_table[pid].task.cr3 = pde_addr_phy_temp;//初始化了进程表中cr3寄存器变量，属性位暂时不管
+	pid2proc(pid)->task.cr3 = pde_addr_phy_temp;//初始化了进程表中cr3寄存器变量，属性位暂时不管
 	/*********************页表初始化部分*********************************/
 	u32 phy_addr=0;
 	
@@ -52,7 +110,7 @@ PUBLIC	u32 init_page_pte(u32 pid)
 									phy_addr,//物理地址	
 									pid,//进程pid						//edit by visual 2016.5.19
 									PG_P  | PG_USU | PG_RWW,//页目录的属性位（用户权限）			//edit by visual 2016.5.26 
-									PG_P  | PG_USS | PG_RWW);//页表的属性位（系统权限）				//edit by visual 2016.5.17 
+									PG_P  | PG_USS | PG_RWW | PG_G);//页表的属性位（系统权限，全局页）	//edit by visual 2016.5.17 
 		if( err_temp!=0 )
 		{
 			disp_color_str("init_page_pte Error:lin_mapping_phy",0x74);
@@ -117,6 +175,98 @@ PUBLIC void page_fault_handler(	u32 vec_no,//异常编号，此时应该是14，
 }
 */
 
+/*======================================================================*
+                              cow_fault
+ *======================================================================*/
+/* the page at addr is shared by fork and written now. if the others have
+ * copied it or exited, it's made writable, otherwise it's copied to a new
+ * frame through SharePageBase. return 0, or -1 if there is no frame.
+ */
+PRIVATE int cow_fault(u32 pte_phy, u32 addr)
+{
+	u32 *pte = (u32*)K_PHY2LIN(pte_phy) + get_pte_index(addr);
+	u32 phy = *pte & 0xFFFFF000;
+	u32 new_phy;
+	u32 eflags = disable_int_save();	//threads share SharePageBase and the frame
+	
+	if(frame_refs(phy) == 0){
+		*pte = (*pte & ~PG_COW) | PG_RWW;
+		invlpg(addr);
+		restore_int(eflags);
+		return 0;
+	}
+	
+	new_phy = test_malloc_4k();
+	if(new_phy == (u32)-1){
+		restore_int(eflags);
+		return -1;
+	}
+	lin_mapping_phy(SharePageBase, new_phy, p_proc_current->task.pid, PG_P | PG_USU | PG_RWW, PG_P | PG_USS | PG_RWW);
+	memcpy((void*)SharePageBase, (void*)(addr & 0xFFFFF000), num_4K);
+	unmap_lin_range(p_proc_current->task.cr3 & 0xFFFFF000, SharePageBase, SharePageLimit, 0);
+	
+	*pte = new_phy | (*pte & 0xFFF & ~PG_COW) | PG_RWW;
+	invlpg(addr);
+	test_free_4k(phy);	//drop the reference of this process
+	restore_int(eflags);
+	return 0;
+}
+
+/*======================================================================*
+                           demand_zero_fault
+ *======================================================================*/
+//a thread uses the heap of its process
+PRIVATE PROCESS* heap_owner()
+{
+	if(p_proc_current->task.info.type == TYPE_THREAD)
+		return pid2proc(p_proc_current->task.info.ppid);
+	return p_proc_current;
+}
+
+/* 1 if addr is in a region the current process has reserved: data and
+ * bss, vpage, heap, and the stacks of it and its threads. those pages
+ * are mapped when they are touched first.
+ */
+PRIVATE int lin_reserved(u32 addr)
+{
+	PROCESS *p = heap_owner();	//the threads use the memmap of their process
+	LIN_MEMMAP *m;
+	
+	if(p == 0)
+		return 0;
+	m = &p->task.memmap;
+	return (addr >= m->data_lin_base && addr < m->data_lin_limit) ||
+		   (addr >= m->vpage_lin_base && addr < m->vpage_lin_limit) ||
+		   (addr >= m->heap_lin_base && addr < m->heap_lin_limit) ||
+		   (addr >= StackLinLimitMAX && addr < m->stack_child_limit) ||
+		   (addr > m->stack_lin_limit && addr <= m->stack_lin_base);
+}
+
+/* map a zero-filled frame at the page of addr. return 0, or -1 if there
+ * is no frame.
+ */
+PRIVATE int demand_zero_fault(u32 addr)
+{
+	u32 pid = p_proc_current->task.pid;
+	u32 page = addr & 0xFFFFF000;
+	u32 phy;
+	u32 eflags = disable_int_save();
+	
+	//another thread may have mapped it since the fault
+	if(pte_exist(get_pde_phy_addr(pid), page) && phy_exist(get_pte_phy_addr(pid, page), page)){
+		restore_int(eflags);
+		return 0;
+	}
+	phy = test_malloc_4k();
+	if(phy == (u32)-1 || lin_mapping_phy(page, phy, pid, PG_P | PG_USU | PG_RWW, PG_P | PG_USU | PG_RWW) != 0){
+		restore_int(eflags);
+		return -1;
+	}
+	memset((void*)page, 0, num_4K);		//through the new mapping, cr3 is the current one
+	restore_int(eflags);
+	return 0;
+}
+
 //modified by xw, 18/6/11
 PUBLIC void page_fault_handler(	u32 vec_no,//异常编号，此时应该是14，代表缺页异常
 								u32 err_code,//错误码
@@ -152,6 +302,27 @@ PUBLIC void page_fault_handler(	u32 vec_no,//异常编号，此时应该是14，
 	//获取该线性地址对应的页表的物理地址
 	pte_addr_phy_temp = get_pte_phy_addr(p_proc_current->task.pid,cr2);
 
+	//a write to a page shared by fork, in user mode or by a syscall
+	if((err_code & (PF_PROT | PF_WRITE)) == (PF_PROT | PF_WRITE) && pte_exist(pde_addr_phy_temp,cr2) &&
+	   (*((u32*)K_PHY2LIN(pte_addr_phy_temp) + get_pte_index(cr2)) & PG_COW)){
+		if(cow_fault(pte_addr_phy_temp,cr2) != 0){
+			disp_color_str("cow_fault: out of memory",0x74);
+			exit_proc(p_proc_current, -1);	//killed like exception_handler() does
+			p_proc_current->task.stat = KILLED;
+		}
+		return;
+	}
+
+	//the first touch of reserved memory, malloc and stacks don't map frames
+	if(!(err_code & PF_PROT) && lin_reserved(cr2)){
+		if(demand_zero_fault(cr2) != 0){
+			disp_color_str("demand_zero_fault: out of memory",0x74);
+			exit_proc(p_proc_current, -1);
+			p_proc_current->task.stat = KILLED;
+		}
+		return;
+	}
+
 	if(cr2 == cr2_save){
 		cr2_count++;
 		if(cr2_count == 5){
@@ -194,7 +365,7 @@ PUBLIC void page_fault_handler(	u32 vec_no,//异常编号，此时应该是14，
 		(*((u32*)K_PHY2LIN(pte_addr_phy_temp) + get_pte_index(cr2)))|= PG_P;		 
 		// disp_color_str("[Solved]",0x74);
 	}
-	refresh_page_cache();
+	invlpg(cr2);
 }
  
 /***************************地址转换过程***************************
@@ -233,13 +404,14 @@ PUBLIC inline u32 get_pte_index(u32 AddrLin)
  *======================================================================*/
  PUBLIC inline u32 get_pde_phy_addr(u32 pid)
  {//获取页目录物理地址
-	 if( proc_table[pid].task.cr3==0 )
+	 PROCESS *p = pid2proc(pid);
+	 if( p==0 || p->task.cr3==0 )
 	 {//还没有初始化页目录
 		return -1;
 	 }
 	 else
 	 {
-		return ((proc_table[pid].task.cr3)&0xFFFFF000);
+		return ((p->task.cr3)&0xFFFFF000);
 	 }	
  }
  
@@ -330,21 +502,44 @@ PUBLIC void write_page_pte(	u32 TblPhyAddr,//页表物理地址
 *======================================================================*/
 PUBLIC u32 vmalloc(	u32 size)
 {
+	PROCESS *p = heap_owner();
 	u32 temp;
-	if(p_proc_current->task.info.type == TYPE_PROCESS )
-	{//进程直接就是标识
-		temp= p_proc_current->task.memmap.heap_lin_limit;
-		p_proc_current->task.memmap.heap_lin_limit += size;
-	}
-	else
-	{//线程需要取父进程的标识
-		temp= *((u32*)p_proc_current->task.memmap.heap_lin_limit);
-		(*((u32*)p_proc_current->task.memmap.heap_lin_limit)) += size;
-	}
+	u32 eflags = disable_int_save();	//the threads grow the same heap
 	
+	temp = p->task.memmap.heap_lin_limit;
+	p->task.memmap.heap_lin_limit += size;
+	restore_int(eflags);
 	return temp;
 }
 
+/*======================================================================*
+*                          sys_sbrk
+*======================================================================*/
+/* move the end of the heap by increment bytes and return the old end, or
+ * -1 if the heap would leave [HeapLinBase, HeapLinLimitMAX). the pages
+ * given back are unmapped, the new ones are mapped when touched.
+ */
+PUBLIC void* sys_sbrk(int increment)
+{
+	PROCESS *p = heap_owner();
+	u32 old, new;
+	u32 eflags = disable_int_save();
+	
+	old = p->task.memmap.heap_lin_limit;
+	new = old + increment;
+	if( (increment > 0 && (new < old || new > HeapLinLimitMAX)) ||
+		(increment < 0 && (new > old || new < p->task.memmap.heap_lin_base)) )
+	{
+		restore_int(eflags);
+		return (void*)-1;
+	}
+	p->task.memmap.heap_lin_limit = new;
+	if( increment < 0 )
+		unmap_lin_range(p->task.cr3 & 0xFFFFF000, (new + num_4K - 1) & 0xFFFFF000, old, 1);
+	restore_int(eflags);
+	return (void*)old;
+}
+
 /*======================================================================*
 *                          lin_mapping_phy		add by visual 2016.5.9
 *将线性地址映射到物理地址上去,函数内部会分配物理地址
@@ -357,17 +552,18 @@ PUBLIC int lin_mapping_phy(u32 AddrLin,//线性地址
 {
 	u32 pte_addr_phy;
 	u32 pde_addr_phy = get_pde_phy_addr(pid);						//add by visual 2016.5.19
+	void *pte;
 	
 	if( 0==pte_exist(pde_addr_phy,AddrLin) )
 	{//页表不存在，创建一个，并填进页目录中
-		pte_addr_phy = (u32)test_kmalloc_4k(); //为页表申请一页
-		memset((void*)K_PHY2LIN(pte_addr_phy),0,num_4K);		//add by visual 2016.5.26
-		
-		if( pte_addr_phy<0 || (pte_addr_phy&0x3FF)!=0 ) 	//add by visual 2016.5.9
+		pte = kmem_cache_alloc(&pgtable_cache); //为页表申请一页
+		if( pte==0 )
 		{	
 			disp_color_str("lin_mapping_phy Error:pte_addr_phy",0x74);
 			return -1;
 		}
+		pte_addr_phy = K_LIN2PHY((u32)pte);
+		memset(pte,0,num_4K);		//add by visual 2016.5.26
 				
 		write_page_pde(	pde_addr_phy,//页目录物理地址
 						AddrLin,//线性地址
@@ -412,7 +608,7 @@ PUBLIC int lin_mapping_phy(u32 AddrLin,//线性地址
 					AddrLin,//线性地址
 					phy_addr,//物理页物理地址
 					pte_Attribute);//属性
-	refresh_page_cache();
+	invlpg(AddrLin);	//only this page has changed, the other TLB entries stay
 	
 	return 0;
 }
@@ -429,3 +625,52 @@ void clear_kernel_pagepte_low()
 	memset((void*)(K_PHY2LIN(KernelPageTblAddr+0x1000)),0,4096*page_num);	//从内核页表中清除线性地址的低端映射关系
 	refresh_page_cache();
 }
+
+
+/*======================================================================*
+*                          unmap_lin_range
+*======================================================================*/
+/* clear the mappings of the pages in [base, limit) in the page directory
+ * pde_phy, and give the frames back to memman if free_frame is 1. a page
+ * already freed by free_4k() is not present, so it isn't freed twice.
+ * the page tables are kept.
+ */
+PUBLIC void unmap_lin_range(u32 pde_phy, u32 base, u32 limit, int free_frame)
+{
+	u32 addr, pte_phy, *pte;
+	
+	for (addr = base & 0xFFFFF000; addr < limit; addr += num_4K) {
+		if (0 == pte_exist(pde_phy, addr)) {
+			addr |= num_4M - num_4K;	//no page table, skip the whole 4M
+			continue;
+		}
+		pte_phy = *((u32*)K_PHY2LIN(pde_phy) + get_pde_index(addr)) & 0xFFFFF000;
+		pte = (u32*)K_PHY2LIN(pte_phy) + get_pte_index(addr);
+		if ((*pte & PG_P) == 0)
+			continue;
+		if (free_frame && (*pte & 0xFFFFF000) != 0)
+			test_free_4k(*pte & 0xFFFFF000);
+		*pte = 0;
+		invlpg(addr);
+	}
+}
+
+/*======================================================================*
+*                          free_page_dir
+*======================================================================*/
+/* give the page tables below KernelLinBase+KernelSize, i.e. the user ones
+ * and those made by init_page_pte(), and the page directory itself back to
+ * pgtable_cache.
+ * the frames must have been released by unmap_lin_range() before.
+ */
+PUBLIC void free_page_dir(u32 pde_phy)
+{
+	u32 *pde = (u32*)K_PHY2LIN(pde_phy);
+	u32 i;
+	
+	for (i = 0; i < get_pde_index(KernelLinBase + KernelSize); i++) {
+		if ((pde[i] & PG_P) && (pde[i] & 0xFFFFF000) != 0)
+			kmem_cache_free(&pgtable_cache, (void*)K_PHY2LIN(pde[i] & 0xFFFFF000));
+	}
+	kmem_cache_free(&pgtable_cache, pde);
+}
@@ -13,41 +13,732 @@
 #include "global.h"
 #include "proto.h"
 
+/*======================================================================*
+                              runqueue
+ *======================================================================*/
+//index of the highest set bit, bitmap mustn't be 0
+PRIVATE int rq_highest(u32 bitmap)
+{
+	int bit;
+	
+	asm volatile ("bsrl %1, %0" : "=r"(bit) : "r"(bitmap));
+	return bit;
+}
+
+//append p to the tail of level in array
+PRIVATE void rq_insert(PRIO_ARRAY *array, PROCESS *p, int level)
+{
+	PROCESS *head = array->queue[level];
+	
+	if (head == 0) {
+		p->task.rq_next = p->task.rq_prev = p;
+		array->queue[level] = p;
+		array->bitmap |= 1 << level;
+	} else {
+		p->task.rq_next = head;
+		p->task.rq_prev = head->task.rq_prev;
+		head->task.rq_prev->task.rq_next = p;
+		head->task.rq_prev = p;
+	}
+	array->nr_active++;
+	p->task.rq_array = array;
+	p->task.rq_prio = level;
+}
+
+PRIVATE void rq_remove(PROCESS *p)
+{
+	PRIO_ARRAY *array = p->task.rq_array;
+	int level = p->task.rq_prio;
+	
+	if (p->task.rq_next == p) {
+		array->queue[level] = 0;
+		array->bitmap &= ~(1 << level);
+	} else {
+		p->task.rq_prev->task.rq_next = p->task.rq_next;
+		p->task.rq_next->task.rq_prev = p->task.rq_prev;
+		if (array->queue[level] == p)
+			array->queue[level] = p->task.rq_next;
+	}
+	array->nr_active--;
+	p->task.rq_array = 0;
+	p->task.rq_next = p->task.rq_prev = 0;
+}
+
+/* the O(1) policy for normal processes. with SCHED_FAIR, sched_fair.c
+ * provides the normal_xxx functions instead.
+ */
+#if !SCHED_FAIR
+//a process of the same level as first sharing cr3 with the current one
+PRIVATE PROCESS* pick_affine(PROCESS *first)
+{
+	u32 cr3 = mm_preferred_cr3();
+	PROCESS *p = first;
+	int i;
+	
+	if (cr3 != 0 && first->task.cr3 != cr3) {
+		for (i = 1, p = first->task.rq_next; i < SCHED_MM_SCAN && p != first;
+			 i++, p = p->task.rq_next) {
+			if (p->task.cr3 == cr3)
+				break;
+		}
+		if (p->task.cr3 != cr3)
+			p = first;
+	}
+	mm_account_pick(first, p);
+	return p;
+}
+
+PRIVATE int rq_level(PROCESS *p)
+{
+	if (p->task.priority < 0)
+		return 0;
+	if (p->task.priority >= NR_PRIOS)
+		return NR_PRIOS - 1;
+	return p->task.priority;
+}
+
+PUBLIC void normal_init_rq()
+{
+	memset(&rq, 0, sizeof(rq));
+	rq.active = &rq.arrays[0];
+	rq.expired = &rq.arrays[1];
+}
+
+/* put a READY process into the active array. a process which has used up
+ * its ticks while sleeping gets a new time slice here.
+ * the caller must disable interrupt.
+ */
+PUBLIC void normal_enqueue(PROCESS *p)
+{
+	if (p->task.rq_array != 0)
+		return;		//already queued
+	
+	if (p->task.ticks <= 0)
+		p->task.ticks = p->task.priority;
+	rq_insert(rq.active, p, rq_level(p));
+	rq.nr_running++;
+}
+
+//the caller must disable interrupt
+PUBLIC void normal_dequeue(PROCESS *p)
+{
+	if (p->task.rq_array == 0)
+		return;		//not queued
+	
+	rq_remove(p);
+	rq.nr_running--;
+}
+
+//prev is preempted by a real-time process, it keeps its place and ticks
+PUBLIC void normal_put_prev(PROCESS *prev)
+{
+	(void)prev;
+}
+
+//curr keeps running until its ticks are used up, see normal_pick_next()
+PUBLIC int normal_wakeup_preempt(PROCESS *p, PROCESS *curr)
+{
+	(void)p;
+	(void)curr;
+	return 0;
+}
+
+/* return the normal process to run, or 0 if there is none. prev is 0 if
+ * it isn't a normal process.
+ */
+PUBLIC PROCESS* normal_pick_next(PROCESS *prev)
+{
+	PRIO_ARRAY *array;
+	
+	if (prev != 0 && prev->task.rq_array != 0) {
+		//Added by xw, 18/4/21
+		if (prev->task.ticks > 0)
+			return prev;	//added by xw, 18/4/26
+		//time slice is used up, refill it and wait in the expired array
+		rq_remove(prev);
+		prev->task.ticks = prev->task.priority;
+		rq_insert(rq.expired, prev, rq_level(prev));
+	}
+	
+	//all active processes have used up their ticks, switch the two arrays
+	if (rq.active->nr_active == 0) {
+		array = rq.active;
+		rq.active = rq.expired;
+		rq.expired = array;
+	}
+	
+	if (rq.active->nr_active == 0)
+		return 0;
+	
+	array = rq.active;
+	return pick_affine(array->queue[rq_highest(array->bitmap)]);
+}
+#endif
+
+/*======================================================================*
+                           real-time class
+ *======================================================================*/
+/* SCHED_FIFO and SCHED_RR processes are queued by rt_priority in their own
+ * array and always run before normal processes. a FIFO process runs until
+ * it sleeps or a higher one is READY, a RR process also goes to the tail of
+ * its level after RR_TIMESLICE ticks.
+ */
+PRIVATE PRIO_ARRAY rt_array;
+
+#define rt_proc(p)	((p)->task.policy != SCHED_NORMAL)
+
+PRIVATE int rt_level(PROCESS *p)
+{
+	if (p->task.rt_priority < 0)
+		return 0;
+	if (p->task.rt_priority >= NR_PRIOS)
+		return NR_PRIOS - 1;
+	return p->task.rt_priority;
+}
+
+PUBLIC void init_runqueue()
+{
+	memset(&rt_array, 0, sizeof(rt_array));
+	normal_init_rq();
+}
+
+//the caller must disable interrupt
+PUBLIC void enqueue_proc(PROCESS *p)
+{
+	if (p != p_proc_current && p->task.ready_tsc == 0)
+		p->task.ready_tsc = read_tsc();	//to measure runqueue delay
+	if (!rt_proc(p)) {
+		normal_enqueue(p);
+		return;
+	}
+	if (p->task.rq_array != 0)
+		return;		//already queued
+	if (p->task.policy == SCHED_RR && p->task.ticks <= 0)
+		p->task.ticks = RR_TIMESLICE;
+	rq_insert(&rt_array, p, rt_level(p));
+}
+
+//the caller must disable interrupt
+PUBLIC void dequeue_proc(PROCESS *p)
+{
+	if (p->task.rq_array == &rt_array)
+		rq_remove(p);
+	else
+		normal_dequeue(p);
+}
+
+/* called by schedule() with interrupt disabled. return the process to run,
+ * or 0 if there is no READY process.
+ */
+PUBLIC PROCESS* pick_next_proc(PROCESS *prev)
+{
+	PROCESS *head;
+	
+	if (prev->task.stat != READY) {
+		//sleeping or killed, it leaves the runqueue
+		dequeue_proc(prev);
+	} else if (prev->task.rq_array == &rt_array &&
+			   prev->task.policy == SCHED_RR && prev->task.ticks <= 0) {
+		//round robin among the same level
+		prev->task.ticks = RR_TIMESLICE;
+		head = rt_array.queue[prev->task.rq_prio];
+		if (head == prev)
+			rt_array.queue[prev->task.rq_prio] = prev->task.rq_next;
+	}
+	
+	if (rt_array.nr_active != 0) {
+		if (!rt_proc(prev))
+			normal_put_prev(prev);
+		return rt_array.queue[rq_highest(rt_array.bitmap)];
+	}
+	return normal_pick_next(rt_proc(prev) ? 0 : prev);
+}
+
+/*======================================================================*
+                           sched_setscheduler
+ *======================================================================*/
+/* change the scheduling class of p. return 0 on success, or -1 if the
+ * arguments are invalid.
+ */
+PUBLIC int set_scheduler(PROCESS *p, int policy, int rt_priority)
+{
+	u32 eflags;
+	int queued;
+	
+	if (policy != SCHED_NORMAL && policy != SCHED_FIFO && policy != SCHED_RR)
+		return -1;
+	if (policy != SCHED_NORMAL && (rt_priority < 0 || rt_priority >= NR_PRIOS))
+		return -1;
+	
+	eflags = disable_int_save();
+	queued = (p->task.rq_array != 0 || p->task.heap_idx != 0);
+	if (queued)
+		dequeue_proc(p);
+	p->task.policy = policy;
+	p->task.rt_priority = (policy == SCHED_NORMAL) ? 0 : rt_priority;
+	if (policy == SCHED_RR)
+		p->task.ticks = RR_TIMESLICE;
+	if (queued)
+		enqueue_proc(p);	//the new class takes effect at the next schedule()
+	resched_curr();
+	restore_int(eflags);
+	return 0;
+}
+
+//the kernel tasks and init may change any policy, see sys_sched_setscheduler()
+#define sched_privileged(p)	((p)->task.pid < NR_TASKS || (p)->task.pid == INIT_PID)
+
+/* pid -1 means the caller itself. the other processes may only set
+ * SCHED_NORMAL for themselves, and only the tasks may change a task.
+ */
+PUBLIC int sys_sched_setscheduler(void *uesp)
+{
+	int pid = get_arg(uesp, 1);
+	int policy = get_arg(uesp, 2);
+	PROCESS *p = (pid == -1) ? p_proc_current : pid2proc(pid);
+	
+	if (p == 0 || p->task.stat == IDLE)
+		return -1;
+	if (!sched_privileged(p_proc_current) && (p != p_proc_current || policy != SCHED_NORMAL))
+		return -1;
+	if (p->task.pid < NR_TASKS && p_proc_current->task.pid >= NR_TASKS)
+		return -1;
+	return set_scheduler(p, policy, get_arg(uesp, 3));
+}
+
+/*======================================================================*
+                         address space affinity
+ *======================================================================*/
+/* a switch to another page directory flushes the TLB, so when the policy
+ * finds several processes equally good, it takes one sharing cr3 with the
+ * process which has just run, i.e. a thread made by pthread or its parent.
+ * such a choice is made at most sched_mm_batch times in a row, then the
+ * policy's own choice runs, so the others can't starve.
+ */
+PRIVATE int sched_mm_batch = SCHED_MM_BATCH;	//0 turns it off
+PRIVATE int mm_batch_count;						//choices made for cr3 in a row
+
+//cr3 the next process had better have, or 0 if there is no preference now
+PUBLIC u32 mm_preferred_cr3()
+{
+	if (mm_batch_count >= sched_mm_batch || p_proc_current == &cpu_table[0])
+		return 0;
+	return p_proc_current->task.cr3;
+}
+
+//the policy would run first, but next is run instead
+PUBLIC void mm_account_pick(PROCESS *first, PROCESS *next)
+{
+	if (next == first) {
+		mm_batch_count = 0;
+		return;
+	}
+	mm_batch_count++;
+	switch_stat.mm_preferred++;
+}
+
+/* set sched_mm_batch to n if n >= 0, return the old value. only the tasks
+ * and init may set it, and never above SCHED_MM_BATCH_MAX, so the others
+ * can't be starved. return -1 for the other callers.
+ */
+PUBLIC int sys_set_mm_batch(int n)
+{
+	int old = sched_mm_batch;
+	
+	if (n < 0)
+		return old;
+	if (!sched_privileged(p_proc_current))
+		return -1;
+	sched_mm_batch = (n > SCHED_MM_BATCH_MAX) ? SCHED_MM_BATCH_MAX : n;
+	return old;
+}
+
+/*======================================================================*
+                              need_resched
+ *======================================================================*/
+/* restart_int, restart_syscall and restart_sysenter only call sched() when
+ * need_resched is set. processes only run on the boot cpu, which owns the
+ * runqueue, so the flag of cpus[0] is always the one to set.
+ */
+PUBLIC void resched_curr()
+{
+	cpus[0].need_resched = 1;
+}
+
+//p has just been queued, the caller must disable interrupt
+PRIVATE void check_preempt_wakeup(PROCESS *p)
+{
+	PROCESS *curr = p_proc_current;
+	
+	if (p == curr)
+		return;
+	if (curr == &cpu_table[0] || curr->task.stat != READY)
+		resched_curr();		//the cpu is idle, or curr is leaving it anyway
+	else if (rt_proc(p)) {
+		if (!rt_proc(curr) || rt_level(p) > rt_level(curr))
+			resched_curr();
+	} else if (!rt_proc(curr) && normal_wakeup_preempt(p, curr))
+		resched_curr();
+}
+
+//make p READY and put it into runqueue, can be called in any context
+PUBLIC void wakeup_proc(PROCESS *p)
+{
+	u32 eflags = disable_int_save();
+	
+	if (p->task.stat == SLEEPING)
+		p->task.wakeup_tsc = read_tsc();	//to measure wakeup latency
+	p->task.stat = READY;
+	enqueue_proc(p);
+	check_preempt_wakeup(p);
+	restore_int(eflags);
+}
+
+/* a PCB copied from its parent by fork or pthread also gets the parent's
+ * links, which must be cleared before the PCB is queued anywhere.
+ */
+PUBLIC void clear_proc_links(PROCESS *p)
+{
+	p->task.rq_next = p->task.rq_prev = 0;
+	p->task.rq_array = 0;
+	p->task.heap_idx = 0;
+	p->task.wakeup_tsc = 0;
+	p->task.sleep_timer.next = 0;
+	p->task.sleep_timer.pprev = 0;
+	p->task.wq_next = p->task.wq_prev = 0;
+	p->task.wq = 0;
+	p->task.killed = 0;
+	p->task.ready_tsc = 0;	//the statistics aren't inherited either
+	memset(&p->task.hist, 0, sizeof(SCHED_HIST));
+	p->task.utime = p->task.stime = 0;
+	p->task.acct_tsc = 0;
+	p->task.nvcsw = p->task.nivcsw = p->task.nsyscalls = 0;
+}
+
+/* the idle task of each cpu. it runs in ring 0, so it can halt the cpu until
+ * the next interrupt, after which schedule() is invoked by restart_int if the
+ * interrupt has woken a process.
+ */
+PUBLIC void cpu_idle()
+{
+	while (1) {
+		asm volatile ("sti\n\t"
+					  "hlt");
+	}
+}
+
+/*======================================================================*
+                         scheduling statistics
+ *======================================================================*/
+//the log2 bucket of a delay in TSC cycles
+PRIVATE int hist_bucket(u64 cycles)
+{
+	u32 low = (u32)cycles;
+	int bit;
+	
+	if ((u32)(cycles >> 32) != 0)
+		return NR_HIST_BUCKETS - 1;
+	if (low == 0)
+		return 0;
+	asm ("bsrl %1, %0" : "=r"(bit) : "rm"(low));
+	return bit;
+}
+
+//count a delay in both the process's and the system-wide histogram
+#define hist_add(p, name, cycles)	do {		\
+		int b = hist_bucket(cycles);			\
+		(p)->task.hist.name[b]++;				\
+		sched_hist.name[b]++;					\
+	} while (0)
+
+//record the latency from a process being woken to getting the cpu
+PRIVATE void account_wakeup(PROCESS *p, u64 now)
+{
+	u64 cycles = now - p->task.wakeup_tsc;
+	
+	p->task.wakeup_tsc = 0;
+	idle_stat.wakeups++;
+	idle_stat.wakeup_cycles += cycles;
+	if (cycles > idle_stat.wakeup_max)
+		idle_stat.wakeup_max = cycles;
+	hist_add(p, wakeup, cycles);
+}
+
+//charge the cycles since the last charge to the field of p
+#define acct_charge(p, field, now)	do {					\
+		if ((p)->task.acct_tsc != 0)						\
+			(p)->task.field += (now) - (p)->task.acct_tsc;	\
+		(p)->task.acct_tsc = (now);							\
+	} while (0)
+
+/* called in kernel.asm with interrupt disabled when the current process
+ * enters the kernel from ring 1 or 3, and when it goes back.
+ */
+PUBLIC void acct_kernel_enter()
+{
+	u64 now = read_tsc();
+	
+	acct_charge(p_proc_current, utime, now);
+}
+
+PUBLIC void acct_kernel_exit()
+{
+	u64 now = read_tsc();
+	
+	acct_charge(p_proc_current, stime, now);
+}
+
+PUBLIC void acct_syscall()
+{
+	p_proc_current->task.nsyscalls++;
+	acct_kernel_enter();
+}
+
+//prev gives up the cpu, a READY one waits in runqueue from now on
+PRIVATE void account_switch_out(PROCESS *prev, u64 now)
+{
+	if (prev == &cpu_table[0]) {
+		if (prev->task.run_tsc != 0)
+			idle_stat.idle_cycles += now - prev->task.run_tsc;
+		return;
+	}
+	acct_charge(prev, stime, now);
+	if (prev->task.stat == READY)
+		prev->task.nivcsw++;
+	else
+		prev->task.nvcsw++;
+	hist_add(prev, slice, now - prev->task.run_tsc);
+	prev->task.ready_tsc = (prev->task.stat == READY) ? now : 0;
+}
+
+PRIVATE void account_switch_in(PROCESS *next, u64 now)
+{
+	if (next->task.ready_tsc != 0)
+		hist_add(next, rq_delay, now - next->task.ready_tsc);
+	next->task.ready_tsc = 0;
+	next->task.run_tsc = now;
+	next->task.acct_tsc = now;
+	if (next->task.wakeup_tsc != 0)
+		account_wakeup(next, now);
+}
+
+/* copy the histograms of process pid, or of all processes if pid is -1,
+ * to buf. return 0, or -1 if there is no such process or buf is invalid.
+ */
+PUBLIC int sys_get_sched_hist(void *uesp)
+{
+	int pid = get_arg(uesp, 1);
+	SCHED_HIST *buf = (SCHED_HIST*)get_arg(uesp, 2);
+	PROCESS *p = 0;
+	u32 eflags;
+	
+	if (!user_buf_ok(buf, sizeof(SCHED_HIST)))
+		return -1;
+	if (pid != -1) {
+		p = pid2proc(pid);
+		if (p == 0 || p->task.stat == IDLE)
+			return -1;
+	}
+	eflags = disable_int_save();
+	memcpy(buf, (p != 0) ? &p->task.hist : &sched_hist, sizeof(SCHED_HIST));
+	restore_int(eflags);
+	return 0;
+}
+
+//number of READY processes, the running one included, for the load average
+PUBLIC int nr_ready_procs()
+{
+	PROCESS *p;
+	int pid, n = 0;
+	
+	for (pid = 0; pid < NR_PIDS; pid++) {
+		p = pid2proc(pid);
+		if (p != 0 && p->task.stat == READY)
+			n++;
+	}
+	return n;
+}
+
+/* take a snapshot of the cpu accounting of at most n processes into buf,
+ * and of the system-wide load into load if it isn't 0. return the number
+ * of processes copied, or -1 if a buffer is invalid.
+ */
+PUBLIC int sys_get_task_stat(void *uesp)
+{
+	TASK_STAT *buf = (TASK_STAT*)get_arg(uesp, 1);
+	int n = get_arg(uesp, 2);
+	LOAD_STAT *load = (LOAD_STAT*)get_arg(uesp, 3);
+	PROCESS *p;
+	TASK_STAT *t = buf;
+	int pid;
+	u32 eflags;
+	u64 now;
+	
+	if (n < 0)
+		return -1;
+	if (n > NR_PIDS)
+		n = NR_PIDS;	//no more are ever copied
+	if ((n != 0 && !user_buf_ok(buf, n * sizeof(TASK_STAT))) ||
+		(load != 0 && !user_buf_ok(load, sizeof(LOAD_STAT))))
+		return -1;
+	eflags = disable_int_save();
+	now = read_tsc();
+	
+	for (pid = 0; pid < NR_PIDS && t < buf + n; pid++) {
+		p = pid2proc(pid);
+		if (p == 0 || p->task.stat == IDLE)
+			continue;
+		t->pid = pid;
+		t->ppid = p->task.info.ppid;
+		memcpy(t->name, p->task.p_name, sizeof(t->name));
+		t->name[sizeof(t->name) - 1] = 0;
+		t->stat = p->task.stat;
+		t->type = p->task.info.type;
+		t->utime = p->task.utime;
+		t->stime = p->task.stime;
+		if (p == p_proc_current)
+			t->stime += now - p->task.acct_tsc;	//it's in this syscall now
+		t->nvcsw = p->task.nvcsw;
+		t->nivcsw = p->task.nivcsw;
+		t->nsyscalls = p->task.nsyscalls;
+		t++;
+	}
+	if (load != 0) {
+		memcpy(load, &load_stat, sizeof(LOAD_STAT));
+		load->tsc = now;
+	}
+	restore_int(eflags);
+	return t - buf;
+}
+
 /*======================================================================*
                               schedule
  *======================================================================*/
+/* called by sched() with interrupt disabled.
+ * modified to use O(1) runqueue instead of scanning proc_table.
+ * the policy is in pick_next_proc(), see SCHED_FAIR.
+ */
 PUBLIC void schedule()
 {
-	PROCESS* p;
-	int	 greatest_ticks = 0;
+	PROCESS *prev = p_proc_current;
+	PROCESS *idle = &cpu_table[0];	//the idle task of this cpu
+	u64 now;
 	
-	//Added by xw, 18/4/21
-	if (p_proc_current->task.stat == READY && p_proc_current->task.ticks > 0) {		
-		p_proc_next = p_proc_current;	//added by xw, 18/4/26
+	cpus[0].need_resched = 0;
+	prev->task.wakeup_tsc = 0;	//it's woken before it could sleep, no latency at all
+	p_proc_next = pick_next_proc(prev);
+	if (p_proc_next == prev)
+		return;
+	
+	now = read_tsc();
+	account_switch_out(prev, now);
+	if (p_proc_next == 0) {
+		//there is no READY process at all, run the idle task and stop the tick
+		if (prev != idle)
+			idle_stat.idle_count++;
+		p_proc_next = idle;
+		idle->task.run_tsc = now;
+		fpu_switch(prev, idle);
+		tick_nohz_enter();
 		return;
 	}
+	
+	tick_nohz_exit();
+	account_switch_in(p_proc_next, now);
+	fpu_switch(prev, p_proc_next);
+}
 
-	while (!greatest_ticks) 
-	{
-		for (p = proc_table; p < proc_table+NR_PCBS; p++)		//edit by visual 2016.4.5
-		{
-			if (p->task.stat == READY && p->task.ticks > greatest_ticks)  //edit by visual 2016.4.5
-			{
-				greatest_ticks = p->task.ticks;
-				// p_proc_current = p;
-				p_proc_next	= p;	//modified by xw, 18/4/26
-			}
+/*======================================================================*
+                           PCB allocation
+ *======================================================================*/
+/* PCBs together with their 8KB kernel stacks are carved out of kmalloc
+ * memory PCBS_PER_SLAB at a time, and are never given back to memman, a
+ * freed PCB goes to pcb_free_list and keeps its LDT descriptor in GDT.
+ */
+PRIVATE PROCESS *pid_table[NR_PIDS];	//maps a pid to its PCB, 0 if the pid is free
+PRIVATE int last_pid = -1;				//the pid allocated last time
+PRIVATE int nr_pcbs;					//number of PCBs got from kmalloc
 
-		}
+//get PCBS_PER_SLAB PCBs from kernel memory and put them into free list.
+//interrupt must be disabled.
+PRIVATE int grow_PCB_slab()
+{
+	PROCESS *p;
+	u32 phy;
+	u16 selector;
+	int i;
+	
+	if (nr_pcbs + PCBS_PER_SLAB > NR_PCBS)
+		return -1;
+	phy = test_kmalloc(PCBS_PER_SLAB * sizeof(PROCESS));
+	if (phy == (u32)-1)
+		return -1;
+	
+	p = (PROCESS*)K_PHY2LIN(phy);
+	for (i = 0; i < PCBS_PER_SLAB; i++, p++) {
+		selector = alloc_ldt_desc(p->task.ldts);
+		if (selector == 0)
+			break;	//GDT is full, the rest of the slab is wasted
+		p->task.ldt_sel = selector;
+		p->task.stat = IDLE;
+		p->task.rq_next = pcb_free_list;
+		pcb_free_list = p;
+		nr_pcbs++;
+	}
+	return i == 0 ? -1 : 0;
+}
 
-		if (!greatest_ticks) 
-		{
-			for (p = proc_table; p < proc_table+NR_PCBS; p++) //edit by visual 2016.4.5
-			{
-				p->task.ticks = p->task.priority;
-			}
+//find a free pid. interrupt must be disabled.
+PRIVATE int alloc_pid(PROCESS *p)
+{
+	int i, pid;
+	
+	for (i = 0; i < NR_PIDS; i++) {
+		pid = (last_pid + 1 + i) % NR_PIDS;
+		if (pid_table[pid] == 0) {
+			pid_table[pid] = p;
+			last_pid = pid;
+			return pid;
 		}
 	}
+	return -1;
+}
+
+/* set a PCB to the state an IDLE user PCB used to be set up in
+ * initialize_processes(). fork and pthread copy the parent over it, but they
+ * depend on the initial frame on the kernel stack.
+ */
+PRIVATE void init_PCB(PROCESS *p)
+{
+	char *p_regs;
+	u16 selector = p->task.ldt_sel;
+	
+	memset(&p->task, 0, sizeof(p->task));
+	p->task.ldt_sel = selector;
+	strcpy(p->task.p_name, "USER");
+	p->task.stat = IDLE;
+	
+	memcpy(&p->task.ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3], sizeof(DESCRIPTOR));
+	p->task.ldts[0].attr1 = DA_C | PRIVILEGE_USER << 5;
+	memcpy(&p->task.ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3], sizeof(DESCRIPTOR));
+	p->task.ldts[1].attr1 = DA_DRW | PRIVILEGE_USER << 5;
+	
+	p->task.regs.cs	= ((8 * 0) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
+	p->task.regs.ds	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
+	p->task.regs.es	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
+	p->task.regs.fs	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
+	p->task.regs.ss	= ((8 * 1) & SA_RPL_MASK & SA_TI_MASK)| SA_TIL | RPL_USER;
+	p->task.regs.gs	= (SELECTOR_KERNEL_GS & SA_RPL_MASK)| RPL_USER;
+	p->task.regs.eflags = 0x0202; /* IF=1, 倒数第二位恒为1 */
+	
+	p_regs = (char*)(p + 1);
+	p_regs -= P_STACKTOP;
+	memcpy(p_regs, (char*)p, 18 * 4);
+	
+	p->task.esp_save_int = p_regs;
+	p->task.esp_save_context = p_regs - 10 * 4;
+	*(u32*)(p_regs - 4) = (u32)restart_restore;
+	*(u32*)(p_regs - 8) = 0x1202;
 }
 
 /*======================================================================*
@@ -55,16 +746,30 @@ PUBLIC void schedule()
  *======================================================================*/
 PUBLIC PROCESS* alloc_PCB()
 {//分配PCB表
-	 PROCESS* p;
-	 int i;
-	 p=proc_table+NR_K_PCBS;//跳过前NR_K_PCBS个
-	 for(i=NR_K_PCBS;i<NR_PCBS;i++)
-	 {
-	   if(p->task.stat==IDLE)break;
-	   p++;	
-	 }
-	if(i>=NR_PCBS)	return 0;   //NULL
-	else	return p;
+	PROCESS* p;
+	int pid;
+	u32 eflags;
+	
+	//take the first PCB of the free list, and get more PCBs when it's empty
+	eflags = disable_int_save();
+	if (pcb_free_list == 0 && grow_PCB_slab() != 0) {
+		restore_int(eflags);
+		return 0;
+	}
+	p = pcb_free_list;
+	pid = alloc_pid(p);
+	if (pid < 0) {
+		restore_int(eflags);
+		return 0;
+	}
+	pcb_free_list = p->task.rq_next;
+	restore_int(eflags);
+	
+	//the PCB is IDLE and has a pid, so nobody else touches it now
+	init_PCB(p);
+	p->task.pid = pid;
+	
+	return p;
 }
 
 /*======================================================================*
@@ -72,47 +777,291 @@ PUBLIC PROCESS* alloc_PCB()
  *======================================================================*/
 PUBLIC void free_PCB(PROCESS *p)
 {//释放PCB表
+	u32 eflags = disable_int_save();
+	
+	fpu_release(p);
+	dequeue_proc(p);
 	p->task.stat=IDLE;
+	if (p->task.pid < NR_PIDS && pid_table[p->task.pid] == p)
+		pid_table[p->task.pid] = 0;
+	p->task.rq_next = pcb_free_list;
+	pcb_free_list = p;
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           pid2proc
+ *======================================================================*/
+//return the PCB of pid, or 0 if no process owns the pid
+PUBLIC PROCESS* pid2proc(int pid)
+{
+	if (pid < 0 || pid >= NR_PIDS)
+		return 0;
+	return pid_table[pid];
+}
+
+/*======================================================================*
+                           add_child
+ *======================================================================*/
+//link child into the child list of parent, used by fork and pthread
+PUBLIC void add_child(PROCESS *parent, PROCESS *child)
+{
+	u32 eflags = disable_int_save();
+	
+	child->task.info.sibling = parent->task.info.child_list;
+	parent->task.info.child_list = child;
+	restore_int(eflags);
 }
 
 /*======================================================================*
                            yield and sleep
  *======================================================================*/
 //used for processes to give up the CPU
+//sched() is called by restart_syscall, since need_resched is set.
 PUBLIC void sys_yield()
 {
 //	p_proc_current->task.ticks--;
 	p_proc_current->task.ticks = 0;	/* modified by xw, 18/4/27 */
 //	save_context();
-	sched();	//Modified by xw, 18/4/19
+	resched_curr();
+}
+
+//the function of sleep_timer
+PRIVATE void process_timeout(u32 data)
+{
+	wakeup_proc((PROCESS*)data);
 }
 
 //used for processes to sleep for n ticks
+//modified to put a timer into the timer wheel, so the process is woken
+//only once when n ticks have passed.
 PUBLIC void sys_sleep(int n)
 {
-	int ticks0;
+	TIMER *timer = &p_proc_current->task.sleep_timer;
+	u32 eflags;
+	
+	if(n <= 0)
+		return;
+	
+	//interrupt is disabled until sched(), so the timer can't fire before
+	//the process is SLEEPING.
+	eflags = disable_int_save();
+	timer->expires = ticks + n;
+	timer->function = process_timeout;
+	timer->data = (u32)p_proc_current;
+	add_timer(timer);
+	
+	p_proc_current->task.channel = timer;
+	p_proc_current->task.stat = SLEEPING;
+//	save_context();
+	sched();	//Modified by xw, 18/4/19, schedule() dequeues the SLEEPING process
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           wait queue
+ *======================================================================*/
+PRIVATE WAIT_QUEUE chan_hash[NR_CHAN_HASH];	//wait queues shared by sleep channels
+
+#define chan_queue(channel)	(&chan_hash[(((u32)(channel) >> 4) ^ ((u32)(channel) >> 12)) \
+									& (NR_CHAN_HASH - 1)])
+
+//interrupt must be disabled
+PRIVATE void wq_add(WAIT_QUEUE *wq, PROCESS *p)
+{
+	p->task.wq = wq;
+	p->task.wq_next = 0;
+	p->task.wq_prev = wq->tail;
+	if (wq->tail != 0)
+		wq->tail->task.wq_next = p;
+	else
+		wq->head = p;
+	wq->tail = p;
+}
+
+//interrupt must be disabled
+PRIVATE void wq_del(PROCESS *p)
+{
+	WAIT_QUEUE *wq = p->task.wq;
 	
-	ticks0 = ticks;
-	p_proc_current->task.channel = &ticks;
+	if (wq == 0)
+		return;
+	if (p->task.wq_prev != 0)
+		p->task.wq_prev->task.wq_next = p->task.wq_next;
+	else
+		wq->head = p->task.wq_next;
+	if (p->task.wq_next != 0)
+		p->task.wq_next->task.wq_prev = p->task.wq_prev;
+	else
+		wq->tail = p->task.wq_prev;
+	p->task.wq_next = p->task.wq_prev = 0;
+	p->task.wq = 0;
+}
+
+PUBLIC void init_wait_queue(WAIT_QUEUE *wq)
+{
+	wq->head = wq->tail = 0;
+}
+
+/* the current process sleeps on wq until it's woken by wake_up(). to avoid
+ * losing a wakeup, disable interrupt before checking the condition to wait
+ * for, and restore it after sleep_on() returns.
+ */
+PUBLIC void sleep_on(WAIT_QUEUE *wq)
+{
+	u32 eflags = disable_int_save();
+	
+	wq_add(wq, p_proc_current);
+	p_proc_current->task.stat = SLEEPING;
+	sched();	//schedule() dequeues the SLEEPING process
+	restore_int(eflags);
+}
+
+//wake up all processes on wq, return the number of woken processes
+PUBLIC int wake_up(WAIT_QUEUE *wq)
+{
+	PROCESS *p;
+	int n = 0;
+	u32 eflags = disable_int_save();
+	
+	while ((p = wq->head) != 0) {
+		wq_del(p);
+		wakeup_proc(p);
+		n++;
+	}
+	restore_int(eflags);
+	return n;
+}
+
+//wake up the process which has waited longest on wq, return 1 if there is one
+PUBLIC int wake_up_one(WAIT_QUEUE *wq)
+{
+	PROCESS *p;
+	u32 eflags = disable_int_save();
 	
-	while(ticks - ticks0 < n){
-		p_proc_current->task.stat = SLEEPING;
-//		save_context();
-		sched();	//Modified by xw, 18/4/19
+	p = wq->head;
+	if (p != 0) {
+		wq_del(p);
+		wakeup_proc(p);
 	}
+	restore_int(eflags);
+	return p != 0;
+}
+
+/* sleep on an address without a wait queue of its own. channels are hashed
+ * into chan_hash, and wakeups only look at the processes in the same bucket.
+ */
+PUBLIC void sleep_on_channel(void *channel)
+{
+	u32 eflags = disable_int_save();
+	
+	p_proc_current->task.channel = channel;
+	sleep_on(chan_queue(channel));
+	p_proc_current->task.channel = 0;
+	restore_int(eflags);
 }
 
-/*invoked by clock-interrupt handler to wakeup 
- *processes sleeping on ticks.
+/* wake up at most nr processes sleeping on channel, or all of them if nr is
+ * 0. if cr3 isn't 0, only the processes in that address space are woken.
  */
+PRIVATE int wake_channel(void *channel, int nr, u32 cr3)
+{
+	WAIT_QUEUE *wq = chan_queue(channel);
+	PROCESS *p, *next;
+	int n = 0;
+	u32 eflags = disable_int_save();
+	
+	for (p = wq->head; p != 0; p = next) {
+		next = p->task.wq_next;
+		if (p->task.channel == channel && (cr3 == 0 || p->task.cr3 == cr3)) {
+			wq_del(p);
+			wakeup_proc(p);
+			if (++n == nr)
+				break;
+		}
+	}
+	restore_int(eflags);
+	return n;
+}
+
+//wake up all processes sleeping on channel
 PUBLIC void sys_wakeup(void *channel)
 {
-	PROCESS *p;
+	wake_channel(channel, 0, 0);
+}
+
+//wake up the process which has slept longest on channel
+PUBLIC void sys_wakeup_one(void *channel)
+{
+	wake_channel(channel, 1, 0);
+}
+
+/* take a SLEEPING process off its wait queue and its sleep timer, so it's
+ * never woken again. the caller must disable interrupt.
+ */
+PUBLIC void stop_proc(PROCESS *p)
+{
+	wq_del(p);
+	del_timer(&p->task.sleep_timer);
+	p->task.channel = 0;
+	dequeue_proc(p);
+}
+
+/*======================================================================*
+                                futex
+ *======================================================================*/
+/* the kernel address of the user word at la of the current process, or 0
+ * if it isn't mapped.
+ */
+PRIVATE int* futex_word(u32 la)
+{
+	int pid = p_proc_current->task.pid;
 	
-	for(p = proc_table; p < proc_table + NR_PCBS; p++){
-		if(p->task.stat == SLEEPING && p->task.channel == channel){
-			p->task.stat = READY;
+	if ((la & 3) != 0 || la >= K_PHY2LIN(0))
+		return 0;
+	if (!pte_exist(get_pde_phy_addr(pid), la) ||
+		!phy_exist(get_pte_phy_addr(pid, la), la))
+		return 0;
+	return (int*)K_PHY2LIN(get_page_phy_addr(pid, la) + (la & 0xFFF));
+}
+
+/* FUTEX_WAIT: sleep on uaddr if *uaddr is still val. return 0 when woken,
+ *             or -1 if *uaddr has changed or uaddr is invalid.
+ * FUTEX_WAKE: wake up at most val processes sleeping on uaddr, return the
+ *             number of woken ones.
+ * the user library only calls it when a lock is contended, see lib/usync.c
+ * a futex is keyed on the page directory and the linear address of the
+ * word, not its frame, for a copy-on-write fault after fork() moves the word
+ * to a new frame while the threads of the process may be sleeping on it.
+ * kernel channels are above K_PHY2LIN(0), so they never match a futex.
+ */
+PUBLIC int sys_futex(void *uesp)
+{
+	u32 uaddr = get_arg(uesp, 1);
+	int op = get_arg(uesp, 2);
+	int val = get_arg(uesp, 3);
+	u32 la = (u32)va2la(p_proc_current->task.pid, (void*)uaddr);
+	int *word = futex_word(la);
+	u32 eflags;
+	
+	if (word == 0)
+		return -1;
+	switch (op) {
+	case FUTEX_WAIT:
+		//no wakeup is lost between the check and sleeping, for interrupt
+		//is disabled and processes only run on the boot cpu
+		eflags = disable_int_save();
+		if (*word != val) {
+			restore_int(eflags);
+			return -1;
 		}
+		sleep_on_channel((void*)la);
+		restore_int(eflags);
+		return 0;
+	case FUTEX_WAKE:
+		return val > 0 ? wake_channel((void*)la, val, p_proc_current->task.cr3) : 0;
+	default:
+		return -1;
 	}
 }
 
@@ -129,7 +1078,7 @@ PUBLIC void* va2la(int pid, void* va)
 		return va;
 	}
 	
-	PROCESS* p = &proc_table[pid];
+	PROCESS* p = pid2proc(pid);
 	u32 seg_base = ldt_seg_linear(p, INDEX_LDT_RW);
 	u32 la = seg_base + (u32)va;
 	
@@ -137,3 +1086,13 @@ PUBLIC void* va2la(int pid, void* va)
 }
 //~zcr
 
+/* 1 if a syscall may write size bytes to buf, which must be in the user
+ * memory under K_PHY2LIN(0), or 0.
+ */
+PUBLIC int user_buf_ok(void *buf, u32 size)
+{
+	u32 addr = (u32)buf;
+	
+	return addr != 0 && addr + size >= addr && addr + size <= K_PHY2LIN(0);
+}
+
@@ -16,6 +16,7 @@
 /* 本文件内函数声明 */
 PRIVATE void init_idt_desc(unsigned char vector, u8 desc_type, int_handler handler, unsigned char privilege);
 PRIVATE void init_descriptor(DESCRIPTOR * p_desc, u32 base, u32 limit, u16 attribute);
+PRIVATE void wrmsr(u32 msr, u32 value);
 
 
 /* 中断处理函数 */
@@ -35,6 +36,7 @@ void	stack_exception();
 void	general_protection();
 void	page_fault();
 void	copr_error();
+void	simd_error();
 void	hwint00();
 void	hwint01();
 void	hwint02();
@@ -51,6 +53,7 @@ void	hwint12();
 void	hwint13();
 void	hwint14();
 void	hwint15();
+void	sysenter_entry();
 
 
 /*======================================================================*
@@ -111,6 +114,9 @@ PUBLIC void init_prot()
 	init_idt_desc(INT_VECTOR_COPROC_ERR,	DA_386IGate,
 		      copr_error,		PRIVILEGE_KRNL);
 
+	init_idt_desc(INT_VECTOR_SIMD_ERR,	DA_386IGate,
+		      simd_error,		PRIVILEGE_KRNL);
+
         init_idt_desc(INT_VECTOR_IRQ0 + 0,      DA_386IGate,
                       hwint00,                  PRIVILEGE_KRNL);
 
@@ -177,19 +183,72 @@ PUBLIC void init_prot()
 			DA_386TSS);
 	tss.iobase	= sizeof(tss);	/* 没有I/O许可位图 */
 
-	// 填充 GDT 中进程的 LDT 的描述符
-	int i;
-	PROCESS* p_proc	= proc_table;
-	u16 selector_ldt = INDEX_LDT_FIRST << 3;
-	//for(i=0;i<NR_TASKS;i++){		
-	for(i=0;i<NR_PCBS;i++){										//edit by visual 2016.4.5	
-		init_descriptor(&gdt[selector_ldt>>3],
-				vir2phys(seg2phys(SELECTOR_KERNEL_DS),proc_table[i].task.ldts),
-				LDT_SIZE * sizeof(DESCRIPTOR) - 1,
-				DA_LDT);
-		p_proc++;
-		selector_ldt += 1 << 3;
-	}
+	/* sysenter/sysexit 使用的四个平坦描述符, 顺序是 CPU 规定的 */
+	init_descriptor(&gdt[INDEX_SYSENTER_CS], 0, 0xfffff,
+			DA_CR | DA_32 | DA_LIMIT_4K);
+	init_descriptor(&gdt[INDEX_SYSENTER_SS], 0, 0xfffff,
+			DA_DRW | DA_32 | DA_LIMIT_4K);
+	init_descriptor(&gdt[INDEX_USER_CS], 0, 0xfffff,
+			DA_CR | DA_32 | DA_LIMIT_4K | DA_DPL3);
+	init_descriptor(&gdt[INDEX_USER_DS], 0, 0xfffff,
+			DA_DRW | DA_32 | DA_LIMIT_4K | DA_DPL3);
+	init_sysenter(&tss);
+
+	// 进程的 LDT 描述符在分配 PCB 时才填充, see alloc_ldt_desc()
+}
+
+
+/*======================================================================*
+                             init_sysenter
+ *----------------------------------------------------------------------*
+ 设置本 CPU 的 sysenter MSR. IA32_SYSENTER_ESP 指向 t->esp0, 由
+ sysenter_entry 从中取出当前进程的内核栈. CPU 不支持时什么也不做,
+ 用户进程仍然用 int 0x90 (see do_syscall in syscall.asm)
+ *======================================================================*/
+PUBLIC void init_sysenter(TSS *t)
+{
+#if FAST_SYSCALL
+	if ((cpuid_edx(1) & CPUID_SEP) == 0)
+		return;
+
+	wrmsr(MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+	wrmsr(MSR_SYSENTER_ESP, (u32)&t->esp0);
+	wrmsr(MSR_SYSENTER_EIP, (u32)sysenter_entry);
+#endif
+}
+
+//the feature flags returned in edx by cpuid leaf
+PUBLIC u32 cpuid_edx(u32 leaf)
+{
+	u32 eax = leaf, ebx, ecx, edx;
+
+	asm volatile ("cpuid"
+				  : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	return edx;
+}
+
+PRIVATE void wrmsr(u32 msr, u32 value)
+{
+	asm volatile ("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+
+/*======================================================================*
+                             alloc_ldt_desc
+ *----------------------------------------------------------------------*
+ 为新分配的 PCB 在 GDT 中填充 LDT 描述符, 返回其选择子, GDT 已满时返回 0
+ *======================================================================*/
+PUBLIC u16 alloc_ldt_desc(DESCRIPTOR *ldts)
+{
+	PRIVATE int index_ldt_next = INDEX_LDT_FIRST;
+	
+	if (index_ldt_next >= GDT_SIZE)
+		return 0;
+	init_descriptor(&gdt[index_ldt_next],
+			vir2phys(seg2phys(SELECTOR_KERNEL_DS), ldts),
+			LDT_SIZE * sizeof(DESCRIPTOR) - 1,
+			DA_LDT);
+	return (index_ldt_next++) << 3;
 }
 
 
@@ -295,6 +354,8 @@ PUBLIC void exception_handler(int vec_no, int err_code, int eip, int cs, int efl
 	disp_str("\n");
 
 	//added by xw, 18/12/19
+	//the killed process is reaped by its parent like an exited one, see exit.c
+	exit_proc(p_proc_current, -1);
 	p_proc_current->task.stat = KILLED;
 	
 	//deleted by xw, 18/6/14
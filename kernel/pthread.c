@@ -13,7 +13,7 @@
 PRIVATE int pthread_pcb_cpy(PROCESS *p_child,PROCESS *p_parent);
 PRIVATE int pthread_update_info(PROCESS *p_child,PROCESS *p_parent);
 PRIVATE int pthread_stack_init(PROCESS *p_child,PROCESS *p_parent);
-PRIVATE int pthread_heap_init(PROCESS *p_child,PROCESS *p_parent);
+PRIVATE int pthread_heap_init(PROCESS *p_child);
 
 /**********************************************************
 *		sys_pthread			//add by visual 2016.5.25
@@ -44,7 +44,7 @@ PUBLIC int sys_pthread(void *entry)
 		PROCESS *p_parent;
 		if( p_proc_current->task.info.type == TYPE_THREAD )
 		{//线程
-			p_parent = &(proc_table[p_proc_current->task.info.ppid]);//父进程
+			p_parent = pid2proc(p_proc_current->task.info.ppid);//父进程
 		}
 		else
 		{//进程
@@ -56,8 +56,8 @@ PUBLIC int sys_pthread(void *entry)
 		/************在父进程的栈中分配子线程的栈（从进程栈的低地址分配8M,注意方向）**********************/
 		pthread_stack_init(p_child,p_parent);
 		
-		/**************初始化子线程的堆（此时的这两个变量已经变成了指针）***********************/
-		pthread_heap_init(p_child,p_parent);
+		/**************初始化子线程的堆（线程没有自己的堆）***********************/
+		pthread_heap_init(p_child);
 		
 		/********************设置线程的执行入口**********************************************/
 		p_child->task.regs.eip = (u32)entry;
@@ -83,7 +83,8 @@ PUBLIC int sys_pthread(void *entry)
 		disp_color_str("]",0x72);
 		
 		//anything child need is prepared now, set its state to ready. added by xw, 17/12/11
-		p_child->task.stat = READY;	
+		//and put it into runqueue
+		wakeup_proc(p_child);
 	}
 	return p_child->task.pid;	
 }
@@ -124,6 +125,7 @@ PRIVATE int pthread_pcb_cpy(PROCESS *p_child,PROCESS *p_parent)
 	//READY when anything else is well prepared. if an interruption happens right here,
 	//an error will still occur.
 	p_child->task.stat = IDLE;
+	clear_proc_links(p_child);	//the links copied from the parent are not the child's
 	p_child->task.esp_save_int = esp_save_int;	//esp_save_int of child must be restored!!
 	p_child->task.esp_save_context = esp_save_context;	//same above
 	memcpy(((char*)(p_child + 1) - P_STACKTOP), ((char*)(p_parent + 1) - P_STACKTOP), 18 * 4);
@@ -131,6 +133,7 @@ PRIVATE int pthread_pcb_cpy(PROCESS *p_child,PROCESS *p_parent)
 	
 	//恢复标识信息
 	p_child->task.pid = pid;
+	p_child->task.fpu_used = 0;	//a new thread starts with a clean FPU state
 	
 	//p_child->task.regs.eflags = eflags;
 	p_reg = (char*)(p_child + 1);	//added by xw, 17/12/11
@@ -152,8 +155,8 @@ PRIVATE int pthread_update_info(PROCESS* p_child,PROCESS *p_parent)
 	if( p_parent!=p_proc_current )
 	{//只有在线程创建线程的时候才会执行	，p_parent事实上是父进程		
 		p_parent->task.info.child_t_num += 1;	//子线程数量
-		p_parent->task.info.child_thread[p_parent->task.info.child_t_num-1] = p_child->task.pid;//子线程列表	
 	}
+	add_child(p_parent, p_child);	//子线程链表, a thread is always linked to its process
 	/************更新父线程的info**************/	
 	//p_proc_current->task.info.type;		//当前是进程还是线程
 	//p_proc_current->task.info.real_ppid;  //亲父进程，创建它的那个进程
@@ -161,7 +164,6 @@ PRIVATE int pthread_update_info(PROCESS* p_child,PROCESS *p_parent)
 	//p_proc_current->task.info.child_p_num += 1; //子进程数量
 	//p_proc_current->task.info.child_process[p_proc_current->task.info.child_p_num-1] = p_child->task.pid;//子进程列表
 	p_proc_current->task.info.child_t_num += 1;	//子线程数量
-	p_proc_current->task.info.child_thread[p_proc_current->task.info.child_t_num-1] = p_child->task.pid;//子线程列表	
 	//p_proc_current->task.text_hold;			//是否拥有代码
 	//p_proc_current->task.data_hold;			//是否拥有数据
 	
@@ -173,6 +175,7 @@ PRIVATE int pthread_update_info(PROCESS* p_child,PROCESS *p_parent)
 	//p_child->task.info.child_process[NR_CHILD_MAX] = pid;//子进程列表
 	p_child->task.info.child_t_num = 0;	//子线程数量
 	//p_child->task.info.child_thread[NR_CHILD_MAX];//子线程列表	
+	p_child->task.info.child_list = 0;	//the list copied from the parent isn't the child's
 	p_child->task.info.text_hold = 0;			//是否拥有代码，子进程不拥有代码
 	p_child->task.info.data_hold = 0;			//是否拥有数据，子进程拥有数据
 	
@@ -185,18 +188,12 @@ PRIVATE int pthread_update_info(PROCESS* p_child,PROCESS *p_parent)
 *************************************************************/
 PRIVATE int pthread_stack_init(PROCESS* p_child,PROCESS *p_parent)
 {
-	int addr_lin;
 	char* p_reg;	//point to a register in the new kernel stack, added by xw, 17/12/11
 	
 	p_child->task.memmap.stack_lin_limit = p_parent->task.memmap.stack_child_limit;//子线程的栈界
 	p_parent->task.memmap.stack_child_limit += 0x4000; //分配16K
 	p_child->task.memmap.stack_lin_base = p_parent->task.memmap.stack_child_limit - num_4B;	//子线程的基址
-	
-	for( addr_lin=p_child->task.memmap.stack_lin_base ; addr_lin>p_child->task.memmap.stack_lin_limit ; addr_lin-=num_4K)//申请物理地址
-	{
-		//disp_str("#");
-		lin_mapping_phy(addr_lin,MAX_UNSIGNED_INT,p_child->task.pid,PG_P  | PG_USU | PG_RWW,PG_P  | PG_USU | PG_RWW);
-	}
+	//栈的物理页在第一次用到时才分配，see demand_zero_fault()
 	
 	p_child->task.regs.esp = p_child->task.memmap.stack_lin_base;		//调整esp
 	p_reg = (char*)(p_child + 1);	//added by xw, 17/12/11
@@ -208,9 +205,10 @@ PRIVATE int pthread_stack_init(PROCESS* p_child,PROCESS *p_parent)
 *		pthread_stack_init			//add by visual 2016.5.26
 *子线程使用父进程的堆
 *************************************************************/
-PRIVATE int pthread_heap_init(PROCESS* p_child,PROCESS *p_parent)
+PRIVATE int pthread_heap_init(PROCESS* p_child)
 {
-	p_child->task.memmap.heap_lin_base = (u32)&(p_parent->task.memmap.heap_lin_base);
-	p_child->task.memmap.heap_lin_limit = (u32)&(p_parent->task.memmap.heap_lin_limit);
+	//不再存父进程的指针, vmalloc()和sbrk()直接用父进程的堆, see heap_owner()
+	p_child->task.memmap.heap_lin_base = 0;
+	p_child->task.memmap.heap_lin_limit = 0;
 	return 0;
 }
@@ -0,0 +1,256 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               sched_fair.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Fair scheduling policy for normal processes, built when SCHED_FAIR
+  is 1. Real-time processes are handled in proc.c before it.
+  Each process accumulates vruntime, its running time in TSC cycles
+  scaled by NICE_0_WEIGHT / weight, and the READY process with the least
+  vruntime runs next. A process gets a share of SCHED_LATENCY_TICKS in
+  proportion to its weight, and a woken process is placed at most
+  SCHED_SLEEPER_CREDIT behind min_vruntime, so I/O-bound processes such
+  as hd_service get the cpu soon without starving the others.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+#if SCHED_FAIR
+
+#define NICE_0_WEIGHT	1024
+#define NR_WEIGHTS		40
+
+/* weight of nice -20~19, each step is about 1.25 times. priority 1, which
+ * every process has by default, is nice 0, and a bigger priority is a
+ * smaller nice.
+ */
+PRIVATE const u32 prio_to_weight[NR_WEIGHTS] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,
+	 3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,
+	  335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,
+	   36,    29,    23,    18,    15,
+};
+
+//2^32 / prio_to_weight[i], so no 64-bit division is needed
+PRIVATE const u32 prio_to_wmult[NR_WEIGHTS] = {
+	    48388,     59856,     76040,     92818,    118348,
+	   147320,    184698,    229616,    287308,    360437,
+	   449829,    563644,    704093,    875809,   1099582,
+	  1376151,   1717300,   2157191,   2708050,   3363326,
+	  4194304,   5237765,   6557202,   8165337,  10153587,
+	 12820798,  15790321,  19976592,  24970740,  31350126,
+	 39045157,  49367440,  61356676,  76695844,  95443717,
+	119304647, 148102320, 186737708, 238609294, 286331153,
+};
+
+PRIVATE int weight_index(PROCESS *p)
+{
+	int idx = 21 - p->task.priority;	//priority 1 is nice 0
+
+	if (idx < 0)
+		return 0;
+	if (idx >= NR_WEIGHTS)
+		return NR_WEIGHTS - 1;
+	return idx;
+}
+
+/*======================================================================*
+                              vruntime heap
+ *======================================================================*/
+PRIVATE void heap_set(int i, PROCESS *p)
+{
+	rq.heap[i] = p;
+	p->task.heap_idx = i;
+}
+
+PRIVATE void sift_up(int i)
+{
+	PROCESS *p = rq.heap[i];
+
+	while (i > 1 && rq.heap[i / 2]->task.vruntime > p->task.vruntime) {
+		heap_set(i, rq.heap[i / 2]);
+		i /= 2;
+	}
+	heap_set(i, p);
+}
+
+PRIVATE void sift_down(int i)
+{
+	PROCESS *p = rq.heap[i];
+	int child;
+
+	while ((child = 2 * i) <= rq.nr_running) {
+		if (child < rq.nr_running &&
+			rq.heap[child + 1]->task.vruntime < rq.heap[child]->task.vruntime)
+			child++;
+		if (rq.heap[child]->task.vruntime >= p->task.vruntime)
+			break;
+		heap_set(i, rq.heap[child]);
+		i = child;
+	}
+	heap_set(i, p);
+}
+
+/*======================================================================*
+                              runqueue
+ *======================================================================*/
+PUBLIC void normal_init_rq()
+{
+	memset(&rq, 0, sizeof(rq));
+}
+
+/* a process which has slept for long mustn't monopolize the cpu with its
+ * old vruntime, but it gets a little credit to run soon after wakeup.
+ */
+PRIVATE void place_proc(PROCESS *p)
+{
+	if (p->task.vruntime + SCHED_SLEEPER_CREDIT < rq.min_vruntime)
+		p->task.vruntime = rq.min_vruntime - SCHED_SLEEPER_CREDIT;
+}
+
+//the caller must disable interrupt
+PUBLIC void normal_enqueue(PROCESS *p)
+{
+	if (p->task.heap_idx != 0)
+		return;		//already queued
+
+	place_proc(p);
+	p->task.weight = prio_to_weight[weight_index(p)];
+	rq.load_weight += p->task.weight;
+	rq.nr_running++;
+	heap_set(rq.nr_running, p);
+	sift_up(rq.nr_running);
+}
+
+//the caller must disable interrupt
+PUBLIC void normal_dequeue(PROCESS *p)
+{
+	int i = p->task.heap_idx;
+	PROCESS *last;
+
+	if (i == 0)
+		return;		//not queued
+
+	rq.load_weight -= p->task.weight;
+	p->task.heap_idx = 0;
+	last = rq.heap[rq.nr_running];
+	rq.heap[rq.nr_running] = 0;
+	rq.nr_running--;
+	if (last != p) {
+		//fill the hole with the last one, which may go either way
+		heap_set(i, last);
+		sift_up(i);
+		sift_down(last->task.heap_idx);
+	}
+}
+
+//charge the cpu time since exec_start to p
+PRIVATE void update_curr(PROCESS *p)
+{
+	u64 now = read_tsc();
+	u64 delta;
+
+	if (p->task.exec_start != 0 && now > p->task.exec_start) {
+		delta = now - p->task.exec_start;
+		if (delta > 0xFFFFFFFF)
+			delta = 0xFFFFFFFF;
+		p->task.vruntime += ((u64)(u32)delta * prio_to_wmult[weight_index(p)]) >> 22;
+		if (p->task.heap_idx != 0)
+			sift_down(p->task.heap_idx);	//vruntime only grows
+	}
+	p->task.exec_start = now;
+}
+
+//ticks p may run for, its share of SCHED_LATENCY_TICKS
+PRIVATE int time_slice(PROCESS *p)
+{
+	int slice = SCHED_LATENCY_TICKS * p->task.weight / rq.load_weight;
+
+	return slice > 0 ? slice : 1;
+}
+
+//prev is preempted by a real-time process, charge it for the time it has run
+PUBLIC void normal_put_prev(PROCESS *prev)
+{
+	if (prev != &cpu_table[0])
+		update_curr(prev);
+}
+
+/* the children of the heap top have nearly the least vruntime too. one of
+ * them sharing cr3 with the current process may run before first, if it's
+ * no more than SCHED_WAKEUP_GRAN behind, see mm_preferred_cr3().
+ */
+PRIVATE PROCESS* pick_affine(PROCESS *first)
+{
+	u32 cr3 = mm_preferred_cr3();
+	PROCESS *next = first;
+	PROCESS *p;
+	int i;
+	
+	if (cr3 != 0 && first->task.cr3 != cr3) {
+		for (i = 2; i <= 3 && i <= rq.nr_running; i++) {
+			p = rq.heap[i];
+			if (p->task.cr3 == cr3 &&
+				p->task.vruntime < first->task.vruntime + SCHED_WAKEUP_GRAN) {
+				next = p;
+				break;
+			}
+		}
+	}
+	mm_account_pick(first, next);
+	return next;
+}
+
+/* called by wakeup_proc() with interrupt disabled after p is queued.
+ * return 1 if p should preempt curr, as normal_pick_next() would do it.
+ */
+PUBLIC int normal_wakeup_preempt(PROCESS *p, PROCESS *curr)
+{
+	update_curr(curr);
+	return p->task.vruntime + SCHED_WAKEUP_GRAN < curr->task.vruntime;
+}
+
+/*======================================================================*
+                           normal_pick_next
+ *======================================================================*/
+/* called by pick_next_proc() with interrupt disabled. return the normal
+ * process to run, or 0 if there is none. prev is 0 if it isn't a normal
+ * process.
+ */
+PUBLIC PROCESS* normal_pick_next(PROCESS *prev)
+{
+	PROCESS *next;
+
+	if (prev != 0 && prev != &cpu_table[0])
+		update_curr(prev);
+
+	if (prev != 0 && prev->task.heap_idx != 0 && prev->task.ticks > 0) {
+		//keep running unless a process has got far less cpu time
+		next = rq.heap[1];
+		if (next == prev ||
+			prev->task.vruntime < next->task.vruntime + SCHED_WAKEUP_GRAN)
+			return prev;
+	}
+
+	if (rq.nr_running == 0)
+		return 0;
+
+	next = rq.heap[1];
+	if (next->task.vruntime > rq.min_vruntime)
+		rq.min_vruntime = next->task.vruntime;
+	next = pick_affine(next);
+	if (next != prev || next->task.ticks <= 0)
+		next->task.ticks = time_slice(next);
+	next->task.exec_start = read_tsc();
+	return next;
+}
+
+#endif
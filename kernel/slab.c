@@ -0,0 +1,201 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               slab.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Object caches for fixed-size kernel objects.
+  A KMEM_CACHE hands out objects of one size from its free list, and
+  gets a new slab from memman only when the list is empty. Like the PCB
+  slabs, they are never given back, a freed object goes back to the free
+  list of its cache. The constructor of a cache is called once for each
+  object when its slab is made, so an object must be freed in the
+  constructed state.
+  kmem_alloc() serves the other sizes from the kmalloc-N caches.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+#define KMALLOC_MIN		32		//the smallest kmalloc-N cache
+#define NR_KMALLOC		7		//kmalloc-32 ~ kmalloc-2048
+#define SLAB_MIN_OBJS	8		//a slab holds at least that many objects
+
+PRIVATE KMEM_CACHE kmalloc_caches[NR_KMALLOC];
+PRIVATE char *kmalloc_names[NR_KMALLOC] = {"kmalloc-32", "kmalloc-64", "kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"};
+PRIVATE SLAB_STAT *slab_stat_table[NR_SLAB_STATS];	//read by get_slab_stat()
+PRIVATE int nr_slab_stats;
+
+//the free pointer of a free object
+#define free_ptr(c, obj)	(*(void**)((char*)(obj) + (c)->offset))
+
+/*======================================================================*
+                           kmem_cache_init
+ *======================================================================*/
+/* without a constructor the free pointer overlays the first word of a free
+ * object, otherwise it's put after the object, so that the constructed
+ * state is kept. align must be a power of 2.
+ */
+PUBLIC void kmem_cache_init(KMEM_CACHE *cache, char *name, u32 size, u32 align,
+							void (*ctor)(void*), int flags)
+{
+	u32 i, eflags;
+
+	if (align < sizeof(void*))
+		align = sizeof(void*);
+	memset(cache, 0, sizeof(KMEM_CACHE));
+	cache->offset = ctor != 0 ? size : 0;
+	if (ctor != 0)
+		size += sizeof(void*);
+	cache->size = (size + align - 1) & ~(align - 1);
+	cache->ctor = ctor;
+	cache->flags = flags;
+
+	if (flags & SLAB_PAGE) {
+		cache->slab_size = num_4K;
+	} else {
+		//buddy blocks are powers of 2 frames
+		cache->slab_size = num_4K;
+		while (cache->slab_size < SLAB_MIN_OBJS * cache->size)
+			cache->slab_size <<= 1;
+	}
+
+	for (i = 0; i < sizeof(cache->stat.name) - 1 && name[i] != 0; i++)
+		cache->stat.name[i] = name[i];
+	cache->stat.obj_size = cache->size;
+
+	eflags = disable_int_save();
+	if (nr_slab_stats < NR_SLAB_STATS)
+		slab_stat_table[nr_slab_stats++] = &cache->stat;
+	restore_int(eflags);
+}
+
+//get a slab from memman and put its objects into the free list
+PRIVATE int cache_grow(KMEM_CACHE *cache)
+{
+	u32 phy;
+	char *slab, *obj;
+
+	if (cache->flags & SLAB_PAGE)
+		phy = test_kmalloc_4k();
+	else
+		phy = test_kmalloc(cache->slab_size);
+	if (phy == (u32)-1)
+		return -1;
+
+	slab = (char*)K_PHY2LIN(phy);
+	for (obj = slab; obj + cache->size <= slab + cache->slab_size; obj += cache->size) {
+		if (cache->ctor != 0)
+			cache->ctor(obj);
+		free_ptr(cache, obj) = cache->free_list;
+		cache->free_list = obj;
+		cache->stat.total++;
+	}
+	cache->stat.slabs++;
+	return 0;
+}
+
+/*======================================================================*
+                      kmem_cache_alloc/kmem_cache_free
+ *======================================================================*/
+//return the linear address of an object, or 0 if memman runs out
+PUBLIC void* kmem_cache_alloc(KMEM_CACHE *cache)
+{
+	u32 eflags = disable_int_save();
+	void *obj;
+
+	if (cache->free_list == 0 && cache_grow(cache) != 0) {
+		restore_int(eflags);
+		return 0;
+	}
+	obj = cache->free_list;
+	cache->free_list = free_ptr(cache, obj);
+	cache->stat.active++;
+	cache->stat.allocs++;
+	restore_int(eflags);
+	return obj;
+}
+
+PUBLIC void kmem_cache_free(KMEM_CACHE *cache, void *obj)
+{
+	u32 eflags = disable_int_save();
+
+	free_ptr(cache, obj) = cache->free_list;
+	cache->free_list = obj;
+	cache->stat.active--;
+	cache->stat.frees++;
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                         kmem_alloc/kmem_free
+ *======================================================================*/
+//the kmalloc-N cache for size bytes, or 0 if it's bigger than them all
+PRIVATE KMEM_CACHE* kmalloc_cache(u32 size)
+{
+	int i;
+
+	for (i = 0; i < NR_KMALLOC; i++) {
+		if (size <= (u32)(KMALLOC_MIN << i))
+			return &kmalloc_caches[i];
+	}
+	return 0;
+}
+
+/* kernel memory of any size, a linear address or 0. the bigger ones are
+ * got from memman directly.
+ */
+PUBLIC void* kmem_alloc(u32 size)
+{
+	KMEM_CACHE *cache = kmalloc_cache(size);
+	u32 phy;
+
+	if (cache != 0)
+		return kmem_cache_alloc(cache);
+	phy = test_kmalloc(size);
+	return phy == (u32)-1 ? 0 : (void*)K_PHY2LIN(phy);
+}
+
+//size must be the one obj is allocated with
+PUBLIC void kmem_free(void *obj, u32 size)
+{
+	KMEM_CACHE *cache = kmalloc_cache(size);
+
+	if (cache != 0)
+		kmem_cache_free(cache, obj);
+	else
+		test_free(K_LIN2PHY((u32)obj), size);
+}
+
+/*======================================================================*
+                              kmem_init
+ *======================================================================*/
+//called by kernel_main() after memman is ready, before any page table is made
+PUBLIC void kmem_init()
+{
+	int i;
+
+	kmem_cache_init(&pgtable_cache, "pgtable", num_4K, num_4K, 0, SLAB_PAGE);
+	for (i = 0; i < NR_KMALLOC; i++)
+		kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], KMALLOC_MIN << i, sizeof(void*), 0, 0);
+}
+
+/* copy the statistics of the idx-th cache to buf.
+ * return 0, or -1 if there are no more caches or buf is invalid.
+ */
+PUBLIC int sys_get_slab_stat(void *uesp)
+{
+	int idx = get_arg(uesp, 1);
+	SLAB_STAT *buf = (SLAB_STAT*)get_arg(uesp, 2);
+	u32 eflags;
+
+	if (idx < 0 || idx >= nr_slab_stats || !user_buf_ok(buf, sizeof(SLAB_STAT)))
+		return -1;
+	eflags = disable_int_save();
+	memcpy(buf, slab_stat_table[idx], sizeof(SLAB_STAT));
+	restore_int(eflags);
+	return 0;
+}
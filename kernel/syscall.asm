@@ -30,6 +30,20 @@ _NR_read			equ 19 ;	//added by xw, 18/6/18
 _NR_write			equ 20 ;	//added by xw, 18/6/18
 _NR_lseek			equ 21 ;	//added by xw, 18/6/18
 _NR_unlink			equ 22 ;	//added by xw, 18/6/18
+_NR_hd_wait			equ 23 ;
+_NR_sched_setscheduler	equ 24 ;
+_NR_get_lock_stat		equ 25 ;
+_NR_get_sched_hist		equ 26 ;
+_NR_get_switch_stat		equ 27 ;
+_NR_set_mm_batch		equ 28 ;
+_NR_futex				equ 29 ;
+_NR_exit				equ 30 ;
+_NR_wait				equ 31 ;
+_NR_pthread_join		equ 32 ;
+_NR_get_task_stat		equ 33 ;
+_NR_clock_gettime		equ 34 ;
+_NR_get_slab_stat		equ 35 ;
+_NR_sbrk				equ 36 ;
 
 INT_VECTOR_SYS_CALL equ 0x90
 
@@ -38,9 +52,7 @@ global	get_ticks
 global	get_pid		;		//add by visual 2016.4.6
 global	kmalloc		;		//add by visual 2016.4.6
 global	kmalloc_4k	;		//add by visual 2016.4.7
-global	malloc		;		//add by visual 2016.4.7
 global	malloc_4k	;		//add by visual 2016.4.7
-global	free		;		//add by visual 2016.4.7
 global	free_4k		;		//add by visual 2016.4.7
 global	fork		;		//add by visual 2016.4.8
 global	pthread		;		//add by visual 2016.4.11
@@ -57,15 +69,75 @@ global	read		;		//added by xw, 18/6/18
 global	write		;		//added by xw, 18/6/18
 global	lseek		;		//added by xw, 18/6/18
 global	unlink		;		//added by xw, 18/6/19
+global	hd_wait		;
+global	sched_setscheduler
+global	get_lock_stat
+global	get_sched_hist
+global	get_switch_stat
+global	set_mm_batch
+global	futex
+global	exit
+global	wait
+global	pthread_join
+global	get_task_stat
+global	clock_gettime
+global	get_slab_stat
+global	sbrk
 
 bits 32
+[section .data]
+cpu_has_sep	db	-1		; -1: 还没检测, 0: 不支持 sysenter, 1: 支持
+
 [section .text]
+; ====================================================================
+;                              do_syscall
+; ====================================================================
+; 所有系统调用都经由这里进入内核, eax 是调用号, ebx 是参数.
+; 运行在 ring 3 且 cpu 支持 sysenter 时走快速路径, 内核从 sysexit 返回到
+; .ret; 否则(ring 1 的任务, 或者不支持的 cpu)仍然用 int 0x90.
+; sysexit 只能返回 ring 3, 内核中的代码也会链接这个文件, 所以每次都要检查 CPL.
+do_syscall:
+%if FAST_SYSCALL
+	push	eax
+	mov	eax, cs
+	and	eax, 3
+	cmp	eax, 3
+	pop	eax				; pop 不影响标志位
+	jne	.int
+	cmp	byte [cpu_has_sep], 0
+	jg	.sysenter
+	je	.int
+	push	eax				; 第一次调用, 检测 CPUID.01H:EDX.SEP[bit 11]
+	push	ebx
+	push	ecx
+	push	edx
+	mov	eax, 1
+	cpuid
+	shr	edx, 11
+	and	edx, 1
+	mov	byte [cpu_has_sep], dl
+	pop	edx
+	pop	ecx
+	pop	ebx
+	pop	eax
+	jmp	do_syscall
+.sysenter:
+	mov	ecx, esp			; sysexit 用 ecx 恢复 esp, 用 edx 恢复 eip
+	mov	edx, .ret
+	sysenter
+.ret:
+	ret
+.int:
+%endif
+	int	INT_VECTOR_SYS_CALL
+	ret
+
 ; ====================================================================
 ;                              get_ticks
 ; ====================================================================
 get_ticks:
 	mov	eax, _NR_get_ticks
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -73,7 +145,7 @@ get_ticks:
 ; ====================================================================
 get_pid:
 	mov	eax, _NR_get_pid
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -82,7 +154,7 @@ get_pid:
 kmalloc:
 	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!
 	mov	eax, _NR_kmalloc
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -91,17 +163,10 @@ kmalloc:
 kmalloc_4k:
 	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!111
 	mov	eax, _NR_kmalloc_4k
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
-; ====================================================================
-;                              malloc		//add by visual 2016.4.7
-; ====================================================================
-malloc:
-	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!111
-	mov	eax, _NR_malloc
-	int	INT_VECTOR_SYS_CALL
-	ret
+; malloc 和 free 在 lib/umalloc.c 中, 小块内存不进内核, 堆用 sbrk 扩展
 	
 ; ====================================================================
 ;                              malloc_4k		//add by visual 2016.4.7
@@ -109,16 +174,7 @@ malloc:
 malloc_4k:
 	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!111
 	mov	eax, _NR_malloc_4k
-	int	INT_VECTOR_SYS_CALL
-	ret
-
-; ====================================================================
-;                              free		//add by visual 2016.4.7
-; ====================================================================
-free:
-	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!111
-	mov	eax, _NR_free
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -127,7 +183,7 @@ free:
 free_4k:
 	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!111
 	mov	eax, _NR_free_4k
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -136,7 +192,7 @@ free_4k:
 fork:
 	;mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!说明:含有一个参数时,一定要这句,不含参数时,可以要这句,也可以不要这句,并不影响结果
 	mov	eax, _NR_fork
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -145,7 +201,7 @@ fork:
 pthread:
 	mov ebx,[esp+4] ; 将C函数调用时传来的参数放到ebx里!!说明:含有一个参数时,一定要这句,不含参数时,可以要这句,也可以不要这句,并不影响结果
 	mov	eax, _NR_pthread
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -154,7 +210,7 @@ pthread:
 udisp_int:
 	mov ebx,[esp+4]
 	mov	eax, _NR_udisp_int
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 	
 ; ====================================================================
@@ -163,7 +219,7 @@ udisp_int:
 udisp_str:
 	mov ebx,[esp+4]
 	mov	eax, _NR_udisp_str
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -172,7 +228,7 @@ udisp_str:
 exec:
 	mov ebx,[esp+4]
 	mov	eax, _NR_exec
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -181,7 +237,7 @@ exec:
 yield:
 	mov ebx,[esp+4]
 	mov	eax, _NR_yield
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -190,7 +246,7 @@ yield:
 sleep:
 	mov ebx,[esp+4]
 	mov	eax, _NR_sleep
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -199,7 +255,7 @@ sleep:
 print_E:
 	mov ebx,[esp+4]
 	mov	eax, _NR_print_E
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -208,7 +264,7 @@ print_E:
 print_F:
 	mov ebx,[esp+4]
 	mov	eax, _NR_print_F
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	ret
 
 ; ====================================================================
@@ -221,7 +277,7 @@ open:
 	push 2			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_open
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
 	
@@ -233,7 +289,7 @@ close:
 	push 1			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_close
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
 
@@ -244,7 +300,7 @@ read:
 	push 3			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_read
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
 
@@ -255,7 +311,7 @@ write:
 	push 3			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_write
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
 
@@ -266,7 +322,7 @@ lseek:
 	push 3			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_lseek
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
 	
@@ -277,6 +333,148 @@ unlink:
 	push 1			;the number of parameters
 	mov ebx, esp
 	mov	eax, _NR_unlink
-	int	INT_VECTOR_SYS_CALL
+	call	do_syscall
 	add esp, 4
 	ret
+
+; ====================================================================
+;                              hd_wait
+; ====================================================================
+; only used by hd_service to sleep until there is a disk request
+hd_wait:
+	mov	eax, _NR_hd_wait
+	call	do_syscall
+	ret
+
+; ====================================================================
+;                              sched_setscheduler
+; ====================================================================
+sched_setscheduler:
+	push 3			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_sched_setscheduler
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              get_lock_stat
+; ====================================================================
+get_lock_stat:
+	push 2			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_get_lock_stat
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              get_sched_hist
+; ====================================================================
+get_sched_hist:
+	push 2			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_get_sched_hist
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              get_switch_stat
+; ====================================================================
+get_switch_stat:
+	mov	ebx, [esp+4]
+	mov	eax, _NR_get_switch_stat
+	call	do_syscall
+	ret
+
+; ====================================================================
+;                              set_mm_batch
+; ====================================================================
+set_mm_batch:
+	mov	ebx, [esp+4]
+	mov	eax, _NR_set_mm_batch
+	call	do_syscall
+	ret
+
+; ====================================================================
+;                              futex
+; ====================================================================
+futex:
+	push 3			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_futex
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              exit
+; ====================================================================
+exit:
+	mov	ebx, [esp+4]
+	mov	eax, _NR_exit
+	call	do_syscall
+	ret				; never returns
+
+; ====================================================================
+;                              wait
+; ====================================================================
+wait:
+	mov	ebx, [esp+4]
+	mov	eax, _NR_wait
+	call	do_syscall
+	ret
+
+; ====================================================================
+;                              pthread_join
+; ====================================================================
+pthread_join:
+	push 2			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_pthread_join
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              get_task_stat
+; ====================================================================
+get_task_stat:
+	push 3			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_get_task_stat
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              clock_gettime
+; ====================================================================
+clock_gettime:
+	push 2			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_clock_gettime
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              get_slab_stat
+; ====================================================================
+get_slab_stat:
+	push 2			;the number of parameters
+	mov ebx, esp
+	mov	eax, _NR_get_slab_stat
+	call	do_syscall
+	add esp, 4
+	ret
+
+; ====================================================================
+;                              sbrk
+; ====================================================================
+sbrk:
+	mov	ebx, [esp+4]
+	mov	eax, _NR_sbrk
+	call	do_syscall
+	ret
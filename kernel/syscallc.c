@@ -51,20 +51,10 @@ PUBLIC void* sys_kmalloc_4k()
 /*======================================================================*
                            sys_malloc		edit by visual 2016.5.4
  *======================================================================*/
+//only the heap grows here, the pages get zero-filled frames when they are touched, see demand_zero_fault()
 PUBLIC void* sys_malloc(int size)		
 {	
-	int vir_addr,phy_addr,AddrLin,pde_addr_phy,pte_addr_phy;
-	vir_addr = vmalloc(size);
-	
-	for( AddrLin=vir_addr; AddrLin<vir_addr+size ; AddrLin += num_4B )//一个字节一个字节处理
-	{
-		lin_mapping_phy(	AddrLin,//线性地址					//add by visual 2016.5.9
-							MAX_UNSIGNED_INT,//物理地址						//edit by visual 2016.5.19
-							p_proc_current->task.pid,//进程pid				//edit by visual 2016.5.19
-							PG_P  | PG_USU | PG_RWW,//页目录的属性位
-							PG_P  | PG_USU | PG_RWW);//页表的属性位		
-	}
-	return (void*)vir_addr;
+	return (void*)vmalloc(size);
 }
 
 
@@ -73,18 +63,7 @@ PUBLIC void* sys_malloc(int size)
  *======================================================================*/
 PUBLIC void* sys_malloc_4k()
 {	
-	int vir_addr,AddrLin,pde_addr_phy,pte_addr_phy,phy_addr;
-	vir_addr = vmalloc(num_4K);
-	
-	for( AddrLin=vir_addr; AddrLin<vir_addr+num_4K ; AddrLin += num_4K )//一页一页处理(事实上只有一页，而且一定没有填写页表，页目录是否填写不确定)
-	{
-		lin_mapping_phy(	AddrLin,//线性地址					//add by visual 2016.5.9
-							MAX_UNSIGNED_INT,//物理地址	
-							p_proc_current->task.pid,//进程pid					//edit by visual 2016.5.19
-							PG_P  | PG_USU | PG_RWW,//页目录的属性位
-							PG_P  | PG_USU | PG_RWW);//页表的属性位				
-	}
-	return (void*)vir_addr;
+	return (void*)vmalloc(num_4K);	//mapped on the first touch like sys_malloc()
 }
 
 
@@ -103,7 +82,11 @@ PUBLIC int sys_free(void *arg)
 PUBLIC int sys_free_4k(void* AddrLin)
 {//线性地址可以不释放，但是页表映射关系必须清除！
 	int phy_addr;				//add by visual 2016.5.9
+	u32 pid = p_proc_current->task.pid;
 	
+	//never touched, so there is no frame yet
+	if( 0==pte_exist(get_pde_phy_addr(pid),(u32)AddrLin) || 0==phy_exist(get_pte_phy_addr(pid,(u32)AddrLin),(u32)AddrLin) )
+		return 0;
 	phy_addr = get_page_phy_addr(p_proc_current->task.pid,(int)AddrLin);//获取物理页的物理地址		//edit by visual 2016.5.19
 	lin_mapping_phy(	(int)AddrLin,//线性地址					
 						phy_addr,//物理地址
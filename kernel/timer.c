@@ -0,0 +1,199 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               timer.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Kernel timers kept in a hierarchical timer wheel.
+  tv1 holds timers expiring in the next 256 ticks, one slot per tick.
+  tvn[0..3] hold later timers, each slot of tvn[i] covering 2^(8+6*i)
+  ticks. When tv1 wraps around, a slot of tvn[0] is cascaded into tv1,
+  and so on. Adding and deleting a timer are O(1), and a tick costs
+  O(expired timers) plus the amortized cascading.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "type.h"
+#include "const.h"
+#include "protect.h"
+#include "string.h"
+#include "proc.h"
+#include "global.h"
+#include "proto.h"
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define NR_TVN		4
+
+//index of the slot of tvn[n] which will be cascaded next
+#define TVN_INDEX(t, n)	(((t) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+PRIVATE TIMER *tv1[TVR_SIZE];
+PRIVATE TIMER *tvn[NR_TVN][TVN_SIZE];
+PRIVATE u32 timer_ticks;	//the wheel has run all timers before this tick
+
+PRIVATE void internal_add_timer(TIMER *timer);
+PRIVATE int  cascade(int n, int index);
+
+/*======================================================================*
+                           init_timers
+ *======================================================================*/
+PUBLIC void init_timers()
+{
+	memset(tv1, 0, sizeof(tv1));
+	memset(tvn, 0, sizeof(tvn));
+	timer_ticks = ticks;
+}
+
+/*======================================================================*
+                           add_timer
+ *======================================================================*/
+/* timer->expires, function and data must be set by the caller. the function
+ * is called in clock interrupt with interrupt disabled once ticks reaches
+ * timer->expires, so it should be short, such as waking up a process.
+ */
+PUBLIC void add_timer(TIMER *timer)
+{
+	u32 eflags = disable_int_save();
+
+	if (timer->pprev != 0)
+		del_timer(timer);	//re-arm a pending timer
+	internal_add_timer(timer);
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           del_timer
+ *======================================================================*/
+/* return 1 if the timer was pending, or 0 if it has expired or was never added.
+ */
+PUBLIC int del_timer(TIMER *timer)
+{
+	u32 eflags = disable_int_save();
+	int pending = 0;
+
+	if (timer->pprev != 0) {
+		*timer->pprev = timer->next;
+		if (timer->next != 0)
+			timer->next->pprev = timer->pprev;
+		timer->next = 0;
+		timer->pprev = 0;
+		pending = 1;
+	}
+	restore_int(eflags);
+	return pending;
+}
+
+/*======================================================================*
+                           run_timers
+ *======================================================================*/
+/* called by clock_handler. it catches up with ticks one tick at a time, so
+ * several ticks passed in tickless idle are handled as well.
+ */
+PUBLIC void run_timers()
+{
+	TIMER *timer, *list;
+	int index;
+	u32 eflags = disable_int_save();
+
+	while ((int)(ticks - timer_ticks) >= 0) {
+		index = timer_ticks & TVR_MASK;
+
+		//tv1 wraps around, fill it with the timers of next 256 ticks
+		if (index == 0 &&
+			cascade(0, TVN_INDEX(timer_ticks, 0)) == 0 &&
+			cascade(1, TVN_INDEX(timer_ticks, 1)) == 0 &&
+			cascade(2, TVN_INDEX(timer_ticks, 2)) == 0)
+			cascade(3, TVN_INDEX(timer_ticks, 3));
+		timer_ticks++;
+
+		list = tv1[index];
+		tv1[index] = 0;
+		while (list != 0) {
+			timer = list;
+			list = timer->next;
+			timer->next = 0;
+			timer->pprev = 0;
+			timer->function(timer->data);
+		}
+	}
+	restore_int(eflags);
+}
+
+/*======================================================================*
+                           timer_next_expiry
+ *======================================================================*/
+/* return how many ticks from now the earliest timer may expire, at most max.
+ * used by tickless idle, so only the next max slots are looked at. a slot of
+ * tvn which will be cascaded in this range counts as expiring, for its timers
+ * aren't in tv1 yet.
+ */
+PUBLIC int timer_next_expiry(int max)
+{
+	u32 t;
+	int delta, n;
+
+	for (delta = 1; delta < max; delta++) {
+		t = ticks + delta;
+		if ((int)(t - timer_ticks) < 0)
+			continue;	//already run
+		if (tv1[t & TVR_MASK] != 0)
+			return delta;
+		if ((t & TVR_MASK) == 0) {
+			for (n = 0; n < NR_TVN; n++) {
+				if (tvn[n][TVN_INDEX(t, n)] != 0)
+					return delta;
+				if (TVN_INDEX(t, n) != 0)
+					break;
+			}
+		}
+	}
+	return max;
+}
+
+/* put the timer into the slot its expires falls in. interrupt must be disabled.
+ */
+PRIVATE void internal_add_timer(TIMER *timer)
+{
+	u32 expires = timer->expires;
+	u32 idx = expires - timer_ticks;
+	TIMER **slot;
+
+	if ((int)idx < 0) {
+		//already expired, run it at the next tick
+		slot = &tv1[timer_ticks & TVR_MASK];
+	} else if (idx < TVR_SIZE) {
+		slot = &tv1[expires & TVR_MASK];
+	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
+		slot = &tvn[0][TVN_INDEX(expires, 0)];
+	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
+		slot = &tvn[1][TVN_INDEX(expires, 1)];
+	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
+		slot = &tvn[2][TVN_INDEX(expires, 2)];
+	} else {
+		slot = &tvn[3][TVN_INDEX(expires, 3)];
+	}
+
+	timer->next = *slot;
+	if (*slot != 0)
+		(*slot)->pprev = &timer->next;
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+/* move the timers in tvn[n][index] to lower levels, and return index, so
+ * the caller knows whether the higher level should be cascaded too.
+ */
+PRIVATE int cascade(int n, int index)
+{
+	TIMER *timer, *list;
+
+	list = tvn[n][index];
+	tvn[n][index] = 0;
+	while (list != 0) {
+		timer = list;
+		list = timer->next;
+		internal_add_timer(timer);
+	}
+	return index;
+}
@@ -24,6 +24,8 @@ global	port_read
 global	port_write
 global	enable_int
 global	disable_int
+global	disable_int_save
+global	restore_int
 
 ; ========================================================================
 ;                  void disp_str(char * info);
@@ -243,5 +245,25 @@ disable_int:
 enable_int:
 	sti
 	ret
+
 ; added by zcr end
 
+; ========================================================================
+;		   u32 disable_int_save();
+; ========================================================================
+; return the old EFLAGS and disable interrupt, so that a critical section
+; can be nested in another one that has disabled interrupt already.
+disable_int_save:
+	pushfd
+	pop		eax
+	cli
+	ret
+
+; ========================================================================
+;		   void restore_int(u32 eflags);
+; ========================================================================
+; restore IF to the value returned by disable_int_save.
+restore_int:
+	push	dword [esp + 4]
+	popfd
+	ret
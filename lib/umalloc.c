@@ -0,0 +1,247 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               umalloc.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  malloc() and free() of the user programs, linked into lib/ulib.a.
+  The heap only grows by sbrk(), and its pages are mapped by the kernel
+  when they are touched first.
+  A small block comes from the free list of its size class in an arena,
+  and only a refill of an empty list calls sbrk(), so most calls never
+  enter the kernel. Each thread runs on its own 16K stack, which picks
+  its arena, so the threads of a process seldom take the same lock.
+  A large block is a run of pages, kept in an address ordered free list
+  after free(), merged with its neighbours, and given back by sbrk() if
+  it's at the end of the heap.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "stdio.h"
+
+#define NR_ARENAS		4			//a power of 2
+#define NR_CLASSES		7			//blocks of 32 ~ 2048 bytes with the head
+#define CLASS_MIN		32
+#define RUN_SIZE		0x4000		//what an arena gets from sbrk() at a time
+#define PAGE_SIZE		0x1000
+#define TRIM_MIN		0x10000		//free at least that much at the end to shrink the heap
+#define STACK_SHIFT		14			//16K thread stacks, see pthread_stack_init()
+#define LARGE			0xFFFF		//MHEAD.arena of a large block
+#define SBRK_FAILED		((void*)-1)
+
+typedef struct mhead {
+	unsigned short arena;		//where it goes back to, LARGE for a large block
+	unsigned short cls;			//size class of a small block
+	unsigned int size;			//bytes with the head
+} MHEAD;						//8 bytes, so the blocks stay 8 bytes aligned
+
+//a free large block
+typedef struct mlarge {
+	MHEAD head;
+	struct mlarge *next;
+} MLARGE;
+
+typedef struct arena {
+	pthread_mutex_t lock;
+	void *free[NR_CLASSES];		//free small blocks, linked by their first word
+} ARENA;
+
+static ARENA arenas[NR_ARENAS];
+static pthread_mutex_t heap_lock;	//the large free list and sbrk()
+static MLARGE *large_free;
+
+#define block_size(cls)		(CLASS_MIN << (cls))
+#define head_of(ptr)		((MHEAD*)(ptr) - 1)
+
+//the arena of the calling thread, without a syscall
+static int my_arena()
+{
+	int esp;
+
+	asm volatile ("mov %%esp, %0" : "=r"(esp));
+	return (esp >> STACK_SHIFT) & (NR_ARENAS - 1);
+}
+
+//the smallest class for size bytes, or -1 if it's a large one
+static int size_class(int size)
+{
+	int cls;
+
+	for (cls = 0; cls < NR_CLASSES; cls++) {
+		if (size + (int)sizeof(MHEAD) <= block_size(cls))
+			return cls;
+	}
+	return -1;
+}
+
+//get size more bytes of heap, 8 bytes aligned. heap_lock must be held
+static char* heap_grow(int size)
+{
+	char *brk = (char*)sbrk(0);
+
+	if (brk == SBRK_FAILED)
+		return 0;
+	if ((int)brk & 7) {	//sys_malloc() may have left it unaligned
+		if (sbrk(8 - ((int)brk & 7)) == SBRK_FAILED)
+			return 0;
+	}
+	brk = (char*)sbrk(size);
+	return brk == SBRK_FAILED ? 0 : brk;
+}
+
+/*======================================================================*
+                             small blocks
+ *======================================================================*/
+//cut a new run into blocks of cls. the arena's lock must be held
+static int arena_refill(ARENA *a, int idx, int cls)
+{
+	int size = block_size(cls);
+	char *run, *b;
+
+	pthread_mutex_lock(&heap_lock);
+	run = heap_grow(RUN_SIZE);
+	pthread_mutex_unlock(&heap_lock);
+	if (run == 0)
+		return -1;
+
+	for (b = run; b + size <= run + RUN_SIZE; b += size) {
+		((MHEAD*)b)->arena = idx;
+		((MHEAD*)b)->cls = cls;
+		((MHEAD*)b)->size = size;
+		*(void**)(b + sizeof(MHEAD)) = a->free[cls];
+		a->free[cls] = b + sizeof(MHEAD);
+	}
+	return 0;
+}
+
+static void* small_alloc(int cls)
+{
+	int idx = my_arena();
+	ARENA *a = &arenas[idx];
+	void *ptr;
+
+	pthread_mutex_lock(&a->lock);
+	if (a->free[cls] == 0 && arena_refill(a, idx, cls) != 0) {
+		pthread_mutex_unlock(&a->lock);
+		return 0;
+	}
+	ptr = a->free[cls];
+	a->free[cls] = *(void**)ptr;
+	pthread_mutex_unlock(&a->lock);
+	return ptr;
+}
+
+//a block goes back to the arena it's cut from, whichever thread frees it
+static void small_free(MHEAD *h)
+{
+	ARENA *a = &arenas[h->arena];
+	void *ptr = h + 1;
+
+	pthread_mutex_lock(&a->lock);
+	*(void**)ptr = a->free[h->cls];
+	a->free[h->cls] = ptr;
+	pthread_mutex_unlock(&a->lock);
+}
+
+/*======================================================================*
+                             large blocks
+ *======================================================================*/
+//first fit, the rest of a bigger block stays free
+static void* large_alloc(int bytes)
+{
+	unsigned int size = (bytes + sizeof(MHEAD) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	MLARGE **pp, *b, *rest;
+
+	pthread_mutex_lock(&heap_lock);
+	for (pp = &large_free; *pp != 0; pp = &(*pp)->next) {
+		b = *pp;
+		if (b->head.size < size)
+			continue;
+		if (b->head.size > size) {
+			rest = (MLARGE*)((char*)b + size);
+			rest->head.arena = LARGE;
+			rest->head.size = b->head.size - size;
+			rest->next = b->next;
+			*pp = rest;
+		} else {
+			*pp = b->next;
+		}
+		b->head.size = size;
+		pthread_mutex_unlock(&heap_lock);
+		return &b->head + 1;
+	}
+
+	b = (MLARGE*)heap_grow(size);
+	pthread_mutex_unlock(&heap_lock);
+	if (b == 0)
+		return 0;
+	b->head.arena = LARGE;
+	b->head.size = size;
+	return &b->head + 1;
+}
+
+static void large_free_block(MLARGE *b)
+{
+	MLARGE **pp, *prev = 0;
+
+	pthread_mutex_lock(&heap_lock);
+	for (pp = &large_free; *pp != 0 && *pp < b; pp = &(*pp)->next)
+		prev = *pp;
+	b->next = *pp;
+	*pp = b;
+
+	if (b->next != 0 && (char*)b + b->head.size == (char*)b->next) {
+		b->head.size += b->next->head.size;
+		b->next = b->next->next;
+	}
+	if (prev != 0 && (char*)prev + prev->head.size == (char*)b) {
+		prev->head.size += b->head.size;
+		prev->next = b->next;
+		b = prev;
+	}
+
+	//the last free block at the end of the heap is given back
+	if (b->next == 0 && b->head.size >= TRIM_MIN &&
+		(char*)b + b->head.size == (char*)sbrk(0)) {
+		for (pp = &large_free; *pp != b; pp = &(*pp)->next)
+			;
+		*pp = 0;
+		sbrk(-(int)b->head.size);
+	}
+	pthread_mutex_unlock(&heap_lock);
+}
+
+/*======================================================================*
+                              malloc/free
+ *======================================================================*/
+//return 0 if there is no more heap
+void* malloc(int size)
+{
+	int cls;
+
+	if (size < 0)
+		return 0;
+	cls = size_class(size);
+	if (cls >= 0)
+		return small_alloc(cls);
+	return large_alloc(size);
+}
+
+void free(void *ptr)
+{
+	MHEAD *h;
+
+	if (ptr == 0)
+		return;
+	h = head_of(ptr);
+	if (h->arena == LARGE)
+		large_free_block((MLARGE*)h);
+	else
+		small_free(h);
+}
+
+//set the end of the heap to addr, return 0 or -1
+int brk(void *addr)
+{
+	char *cur = (char*)sbrk(0);
+
+	if (cur == SBRK_FAILED || sbrk((char*)addr - cur) == SBRK_FAILED)
+		return -1;
+	return 0;
+}
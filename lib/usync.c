@@ -0,0 +1,145 @@
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+                               usync.c
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  Mutexes, condition variables and barriers for the threads made by
+  pthread(), linked into lib/ulib.a.
+  They are built on atomic instructions on the user word, and only call
+  futex() to sleep or to wake up a sleeper, so an uncontended lock never
+  enters the kernel.
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+#include "stdio.h"
+
+#define WAKE_ALL	0x7FFFFFFF
+
+//set *addr to new if it's old, return the value it had
+static int cmpxchg(volatile int *addr, int old, int new)
+{
+	int prev;
+
+	asm volatile ("lock cmpxchgl %2, %1"
+				  : "=a"(prev), "+m"(*addr)
+				  : "r"(new), "0"(old)
+				  : "memory");
+	return prev;
+}
+
+static int xchg(volatile int *addr, int value)
+{
+	asm volatile ("xchgl %0, %1"
+				  : "+r"(value), "+m"(*addr)
+				  :
+				  : "memory");
+	return value;
+}
+
+//add value to *addr, return the value it had
+static int xadd(volatile int *addr, int value)
+{
+	asm volatile ("lock xaddl %0, %1"
+				  : "+r"(value), "+m"(*addr)
+				  :
+				  : "memory");
+	return value;
+}
+
+/*======================================================================*
+                                mutex
+ *======================================================================*/
+/* state 0: unlocked, 1: locked, 2: locked and there may be sleepers.
+ * only unlocking a mutex in state 2 calls futex() to wake one up.
+ */
+void pthread_mutex_init(pthread_mutex_t *mutex)
+{
+	mutex->state = 0;
+}
+
+void pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	int c = cmpxchg(&mutex->state, 0, 1);
+
+	if (c == 0)
+		return;		//uncontended
+	if (c != 2)
+		c = xchg(&mutex->state, 2);
+	while (c != 0) {
+		futex((int*)&mutex->state, FUTEX_WAIT, 2);
+		c = xchg(&mutex->state, 2);
+	}
+}
+
+//return 0 if the mutex is got, or -1 without waiting
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	return cmpxchg(&mutex->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	if (xadd(&mutex->state, -1) != 1) {
+		mutex->state = 0;
+		futex((int*)&mutex->state, FUTEX_WAKE, 1);
+	}
+}
+
+/*======================================================================*
+                          condition variable
+ *======================================================================*/
+/* seq is bumped by every signal, so a waiter doesn't sleep if a signal
+ * comes between unlocking the mutex and futex().
+ */
+void pthread_cond_init(pthread_cond_t *cond)
+{
+	cond->seq = 0;
+}
+
+void pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	int seq = cond->seq;
+
+	pthread_mutex_unlock(mutex);
+	futex((int*)&cond->seq, FUTEX_WAIT, seq);
+	//others may be woken together, so take the mutex as contended
+	while (xchg(&mutex->state, 2) != 0)
+		futex((int*)&mutex->state, FUTEX_WAIT, 2);
+}
+
+void pthread_cond_signal(pthread_cond_t *cond)
+{
+	xadd(&cond->seq, 1);
+	futex((int*)&cond->seq, FUTEX_WAKE, 1);
+}
+
+void pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	xadd(&cond->seq, 1);
+	futex((int*)&cond->seq, FUTEX_WAKE, WAKE_ALL);
+}
+
+/*======================================================================*
+                               barrier
+ *======================================================================*/
+void pthread_barrier_init(pthread_barrier_t *barrier, int count)
+{
+	barrier->count = count;
+	barrier->waiting = 0;
+	barrier->phase = 0;
+}
+
+/* wait until count threads have arrived. return 1 in the last one, which
+ * releases the others, and 0 in the others.
+ */
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+	int phase = barrier->phase;
+
+	if (xadd(&barrier->waiting, 1) + 1 == barrier->count) {
+		barrier->waiting = 0;	//before phase changes, so the next round starts clean
+		xadd(&barrier->phase, 1);
+		futex((int*)&barrier->phase, FUTEX_WAKE, WAKE_ALL);
+		return 1;
+	}
+	while (barrier->phase == phase)
+		futex((int*)&barrier->phase, FUTEX_WAIT, phase);
+	return 0;
+}